@@ -1,22 +1,158 @@
 #include "aes.h"
 
+#include "aes_ni.h"
+#include "aes_simd.h"
 #include "log.h"
+#include <array>
+#include <atomic>
 #include <initializer_list>
 #include <iomanip>
 #include <string>
 #include <sstream>
 
 namespace AESLib {
+    static_assert(S_BOX[0x00] == 0x63 && S_BOX[0x01] == 0x7c && S_BOX[0xff] == 0x16);
+    static_assert(S_BOX[0x53] == 0xed);  // FIPS 197 section 5.1.1.
+    static_assert(INV_S_BOX[0x00] == 0x52 && INV_S_BOX[0x63] == 0x00 && INV_S_BOX[0xff] == 0x7d);
+
+    typedef std::array<std::array<Word, 256>, 4> TTable;
+
+    constexpr TTable MakeTTable(const Byte (&matrix_row)[4], bool with_s_box) {
+        // T[row][x] is the column which x contributes to (Inv)MixColumns when it
+        // sits in the given row, packed like the key schedule words (row 0 in
+        // the highest byte). For the forward table x goes through S-box first.
+        TTable ret = {};
+        for (int row = 0; row < 4; row++) {
+            for (int x = 0; x < 0x100; x++) {
+                Byte y = with_s_box ? S_BOX[x] : (Byte) x;
+                Word column = 0;
+                for (int i = 0; i < 4; i++) {
+                    column = column << 8 | GF_MUL[matrix_row[(row - i) & 3]][y];
+                }
+                ret[row][x] = column;
+            }
+        }
+        return ret;
+    }
+
+    constexpr Byte MIX_COLUMNS_ROW[4] = {0x2, 0x3, 0x1, 0x1};
+    constexpr Byte INV_MIX_COLUMNS_ROW[4] = {0xe, 0xb, 0xd, 0x9};
+
+    // TE fuses SubBytes and MixColumns. TD is InvMixColumns only, since InvRound
+    // applies InvMixColumns before InvShiftRows and InvSubBytes.
+    static constexpr TTable TE = MakeTTable(MIX_COLUMNS_ROW, true);
+    static constexpr TTable TD = MakeTTable(INV_MIX_COLUMNS_ROW, false);
+
+    static_assert(TE[0][0x00] == 0xc66363a5);
+    static_assert(TE[3][0x00] == 0x6363a5c6);
+    static_assert(TD[0][0x01] == 0x0e090d0b);
+
+    static inline void LoadColumns(const Status &status, Word *col) {
+        for (int c = 0; c < 4; c++) {
+            col[c] = status.Column(c);
+        }
+    }
+
+    static inline void StoreColumns(Status &status, const Word *col) {
+        for (int c = 0; c < 4; c++) {
+            status.SetColumn(c, col[c]);
+        }
+    }
+
+    static inline void TRound(Word *col, const Word *key) {
+        // SubBytes, ShiftRows, MixColumns and AddRoundKey on column words.
+        Word ret[4];
+        for (int c = 0; c < 4; c++) {
+            ret[c] = TE[0][col[c] >> 24] ^
+                     TE[1][col[(c + 1) & 3] >> 16 & 0xff] ^
+                     TE[2][col[(c + 2) & 3] >> 8 & 0xff] ^
+                     TE[3][col[(c + 3) & 3] & 0xff] ^
+                     key[c];
+        }
+        for (int c = 0; c < 4; c++) {
+            col[c] = ret[c];
+        }
+    }
+
+    static inline void TFinalRound(Word *col, const Word *key) {
+        // The last round has no MixColumns.
+        Word ret[4];
+        for (int c = 0; c < 4; c++) {
+            ret[c] = WordByByte(
+                    S_BOX[col[c] >> 24],
+                    S_BOX[col[(c + 1) & 3] >> 16 & 0xff],
+                    S_BOX[col[(c + 2) & 3] >> 8 & 0xff],
+                    S_BOX[col[(c + 3) & 3] & 0xff]
+            ) ^ key[c];
+        }
+        for (int c = 0; c < 4; c++) {
+            col[c] = ret[c];
+        }
+    }
+
+    static inline Word TFinalRoundColumn(const Word *col, Word key, int c) {
+        // Column c of TFinalRound only.
+        return WordByByte(
+                S_BOX[col[c] >> 24],
+                S_BOX[col[(c + 1) & 3] >> 16 & 0xff],
+                S_BOX[col[(c + 2) & 3] >> 8 & 0xff],
+                S_BOX[col[(c + 3) & 3] & 0xff]
+        ) ^ key;
+    }
+
+    static inline void TInvRound(Word *col, const Word *key, bool inv_mix_columns) {
+        // AddRoundKey, InvMixColumns, InvShiftRows and InvSubBytes on column words.
+        Word temp[4];
+        for (int c = 0; c < 4; c++) {
+            temp[c] = col[c] ^ key[c];
+            if (inv_mix_columns) {
+                temp[c] = TD[0][temp[c] >> 24] ^
+                          TD[1][temp[c] >> 16 & 0xff] ^
+                          TD[2][temp[c] >> 8 & 0xff] ^
+                          TD[3][temp[c] & 0xff];
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            Byte b0 = temp[c] >> 24;
+            Byte b1 = temp[(c + 3) & 3] >> 16 & 0xff;
+            Byte b2 = temp[(c + 2) & 3] >> 8 & 0xff;
+            Byte b3 = temp[(c + 1) & 3] & 0xff;
+            col[c] = WordByByte(
+                    INV_S_BOX[b0],
+                    INV_S_BOX[b1],
+                    INV_S_BOX[b2],
+                    INV_S_BOX[b3]
+            );
+        }
+    }
+
+    // Read by every worker on the fast paths, so a switch while they run is
+    // no data race. Relaxed, since nothing else is published with it.
+    static std::atomic<Backend> backend(HasAESNI() ? Backend::AESNI : Backend::Portable);
+
+    Backend GetBackend() {
+        return backend.load(std::memory_order_relaxed);
+    }
+
+    void SetBackend(Backend backend_) {
+        if (backend_ == Backend::AESNI && not HasAESNI()) {
+            Log::Warning("AES-NI is not supported, keep the portable backend.");
+            return;
+        }
+        backend.store(backend_, std::memory_order_relaxed);
+    }
+
     Status::Status() = default;
 
     Status::Status(const std::initializer_list<Byte> &bytes) {
+        // The bytes are given row by row.
         auto iter = bytes.begin();
-        for (auto &i: value) {
-            for (auto &j: i) {
+        for (int i = 0; i < N_B; i++) {
+            for (int j = 0; j < 4; j++) {
                 if (iter == bytes.end()) {
-                    j = 0;
+                    value[i][j] = 0;
                 } else {
-                    j = *iter;
+                    value[i][j] = *iter;
                     iter++;
                 }
             }
@@ -24,74 +160,77 @@ namespace AESLib {
     }
 
     Status::Status(const std::initializer_list<Word> &words) {
+        // Every word is a row.
         auto iter = words.begin();
-        for (auto &i: value) {
+        for (int i = 0; i < N_B; i++) {
             Word temp = 0;
             if (iter != words.end()) {
                 temp = *iter;
                 iter++;
             }
             for (int j = 0; j < 4; j++) {
-                i[3 - j] = temp & 0xff;
+                value[i][3 - j] = temp & 0xff;
                 temp >>= 8;
             }
         }
     }
 
-    bool Status::operator==(const Status &y) const {
+    std::string Status::ToString() const {
+        using namespace std;
+        stringstream ss;
         for (int i = 0; i < N_B; i++) {
             for (int j = 0; j < 4; j++) {
-                if (value[i][j] != y.value[i][j]) {
-                    return false;
-                }
+                ss << setw(2) << setfill('0') << hex << (int) value[i][j] << " ";
             }
+            ss << endl;
         }
-        return true;
+        return ss.str();
     }
 
-    void Status::operator+=(const Status &y) {
+    std::string Status::ToHex() const {
+        using namespace std;
+        stringstream ss;
         for (int i = 0; i < N_B; i++) {
             for (int j = 0; j < 4; j++) {
-                value[i][j] ^= y.value[i][j];
+                ss << setw(2) << setfill('0') << hex << (int) value[i][j];
             }
         }
+        return ss.str();
     }
 
-    Status Status::operator+(const Status &y) {
-        Status ret = {};
-        for (int i = 0; i < N_B; i++) {
-            for (int j = 0; j < 4; j++) {
-                ret.value[i][j] = value[i][j] ^ y.value[i][j];
-            }
+    bool Status::FromHex(const std::string &text, Status &status) {
+        if (text.size() != 32) {
+            return false;
         }
-        return ret;
-    }
-
-    std::string Status::ToString() const {
-        using namespace std;
-        stringstream ss;
-        for (auto &i: value) {
-            for (auto j: i) {
-                ss << setw(2) << setfill('0') << hex << (int) j << " ";
+        Status parsed;
+        for (int k = 0; k < 32; k++) {
+            int digit;
+            char c = text[k];
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                return false;
             }
-            ss << endl;
+            Byte &x = parsed.value[k >> 3][k >> 1 & 3];
+            x = (Byte) (x << 4 | digit);
         }
-        return ss.str();
+        status = parsed;
+        return true;
     }
 
     void Status::SubBytes() {
-        for (auto &i: value) {
-            for (auto &j: i) {
-                j = S_BOX[j >> 4][j & 0xf];
-            }
+        for (auto &i: value.data) {
+            i = S_BOX[i];
         }
     }
 
     void Status::InvSubBytes() {
-        for (auto &i: value) {
-            for (auto &j: i) {
-                j = INV_S_BOX[j >> 4][j & 0xf];
-            }
+        for (auto &i: value.data) {
+            i = INV_S_BOX[i];
         }
     }
 
@@ -128,54 +267,56 @@ namespace AESLib {
     }
 
     void Status::MixColumns() {
-        static Byte matrix[4][4] = {
+        if (GetSIMDLevel() != SIMDLevel::Scalar) {
+            SIMDMixColumns(*this);
+            return;
+        }
+        static const Byte matrix[4][4] = {
                 0x2, 0x3, 0x1, 0x1,
                 0x1, 0x2, 0x3, 0x1,
                 0x1, 0x1, 0x2, 0x3,
                 0x3, 0x1, 0x1, 0x2,
         };
-        static Status temp = {};
-        GFMatrixMul(matrix, value, temp.value);
+        Byte x[4][4], temp[4][4];
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                x[i][j] = value[i][j];
+            }
+        }
+        GFMatrixMul(matrix, x, temp);
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
-                value[i][j] = temp.value[i][j];
+                value[i][j] = temp[i][j];
             }
         }
     }
 
     void Status::InvMixColumns() {
-        static Byte matrix[4][4] = {
+        if (GetSIMDLevel() != SIMDLevel::Scalar) {
+            SIMDInvMixColumns(*this);
+            return;
+        }
+        static const Byte matrix[4][4] = {
                 0xe, 0xb, 0xd, 0x9,
                 0x9, 0xe, 0xb, 0xd,
                 0xd, 0x9, 0xe, 0xb,
                 0xb, 0xd, 0x9, 0xe,
         };
-        static Status temp = {};
-        GFMatrixMul(matrix, value, temp.value);
+        Byte x[4][4], temp[4][4];
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
-                value[i][j] = temp.value[i][j];
+                x[i][j] = value[i][j];
             }
         }
-    }
-
-    Byte GFMul(Byte x, Byte y) {
-        // Multiplication in GF(2^8) for AESLib modulo x^8+x^4+x^3+x+1.
-        Byte ret = 0;
-        for (; x; x >>= 1) {
-            if (x & 1)
-                ret ^= y;
-            if (y & 0x80) {
-                y <<= 1;
-                y ^= 0x1b;
-            } else {
-                y <<= 1;
+        GFMatrixMul(matrix, x, temp);
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                value[i][j] = temp[i][j];
             }
         }
-        return ret;
     }
 
-    void GFMatrixMul(Byte x[4][4], Byte y[4][4], Byte ret[4][4]) {
+    void GFMatrixMul(const Byte x[4][4], const Byte y[4][4], Byte ret[4][4]) {
         for(int row = 0; row < 4; row++) {
             for(int col = 0; col < 4; col++) {
                 ret[row][col] = 0;
@@ -186,15 +327,6 @@ namespace AESLib {
         }
     }
 
-    Byte GFInvSlow(Byte x) {
-        for (int i = 0; i < 0xff; i++) {
-            if (GFMul(i, x) == 1) {
-                return i;
-            }
-        }
-        return 0;
-    }
-
     Byte ByteInWord(Word x, int y) {
         return x >> (24 - y * 8) & 0xff;
     }
@@ -232,15 +364,15 @@ namespace AESLib {
             }
             w[i] = w[i - n_k] ^ temp;
         }
+        for (int round = 0; round <= n_r; round++) {
+            for (int col = 0; col < 4; col++) {
+                round_key[round].SetColumn(col, w[round * 4 + col]);
+            }
+        }
     }
 
     void AES::AddRoundKey(Status &status, int round) const {
-        int base = round * 4;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                status.value[i][j] ^= (w[base + j] >> (24 - i * 8)) & 0xff;
-            }
-        }
+        status += round_key[round];
     }
 
     void AES::Round(Status &status, int round) const {
@@ -289,14 +421,145 @@ namespace AESLib {
         return Cipher(status) + status;
     }
 
+    void AES::RoundFast(Status &status, int round) const {
+        if (GetBackend() == Backend::AESNI) {
+            AESNIRound(status, round_key[round], round == n_r);
+            return;
+        }
+        Word col[4];
+        LoadColumns(status, col);
+        if (round != n_r) {
+            TRound(col, w + round * 4);
+        } else {
+            TFinalRound(col, w + round * 4);
+        }
+        StoreColumns(status, col);
+    }
+
+    void AES::InvRoundFast(Status &status, int round) const {
+        if (GetBackend() == Backend::AESNI) {
+            AESNIInvRound(status, round_key[round], round == n_r);
+            return;
+        }
+        Word col[4];
+        LoadColumns(status, col);
+        TInvRound(col, w + round * 4, round != n_r);
+        StoreColumns(status, col);
+    }
+
+    Status AES::CipherFast(Status status) const {
+        if (GetBackend() == Backend::AESNI) {
+            return AESNICipher(status, round_key, n_r);
+        }
+        Word col[4];
+        LoadColumns(status, col);
+        for (int c = 0; c < 4; c++) {
+            col[c] ^= w[c];
+        }
+        for (int round = 1; round < n_r; round++) {
+            TRound(col, w + round * 4);
+        }
+        TFinalRound(col, w + n_r * 4);
+        StoreColumns(status, col);
+        return status;
+    }
+
+    Status AES::CompressionFunctionFast(Status status) const {
+        if (GetBackend() == Backend::AESNI) {
+            return AESNICompressionFunction(status, round_key, n_r);
+        }
+        return CipherFast(status) + status;
+    }
+
+    Word AES::CompressionColumnFast(Status status, int col) const {
+        if (GetBackend() == Backend::AESNI) {
+            return AESNICompressionFunction(status, round_key, n_r).Column(col);
+        }
+        Word x[4];
+        LoadColumns(status, x);
+        for (int c = 0; c < 4; c++) {
+            x[c] ^= w[c];
+        }
+        for (int round = 1; round < n_r; round++) {
+            TRound(x, w + round * 4);
+        }
+        return TFinalRoundColumn(x, w[n_r * 4 + col], col) ^ status.Column(col);
+    }
+
+    void RoundFast(Status &status, const Status &round_key, bool last_round) {
+        if (GetBackend() == Backend::AESNI) {
+            AESNIRound(status, round_key, last_round);
+            return;
+        }
+        Word col[4], key[4];
+        LoadColumns(status, col);
+        LoadColumns(round_key, key);
+        if (not last_round) {
+            TRound(col, key);
+        } else {
+            TFinalRound(col, key);
+        }
+        StoreColumns(status, col);
+    }
+
+    void InvRoundFast(Status &status, const Status &round_key, bool last_round) {
+        if (GetBackend() == Backend::AESNI) {
+            AESNIInvRound(status, round_key, last_round);
+            return;
+        }
+        Word col[4], key[4];
+        LoadColumns(status, col);
+        LoadColumns(round_key, key);
+        TInvRound(col, key, not last_round);
+        StoreColumns(status, col);
+    }
+
+    Status CompressionFunctionFast(const Status &status, const Status *round_key, int n_r) {
+        if (GetBackend() == Backend::AESNI) {
+            return AESNICompressionFunction(status, round_key, n_r);
+        }
+        Status ret = status + round_key[0];
+        for (int round = 1; round <= n_r; round++) {
+            RoundFast(ret, round_key[round], round == n_r);
+        }
+        return ret + status;
+    }
+
+    Word CompressionColumnFast(const Status &status, const Status *round_key, int n_r, int col) {
+        if (GetBackend() == Backend::AESNI) {
+            return AESNICompressionFunction(status, round_key, n_r).Column(col);
+        }
+        Word x[4], key[4];
+        LoadColumns(status, x);
+        LoadColumns(round_key[0], key);
+        for (int c = 0; c < 4; c++) {
+            x[c] ^= key[c];
+        }
+        for (int round = 1; round < n_r; round++) {
+            LoadColumns(round_key[round], key);
+            TRound(x, key);
+        }
+        return TFinalRoundColumn(x, round_key[n_r].Column(col), col) ^ status.Column(col);
+    }
+
     void AES::ReadW(Word *w_) const {
         for (int i = 0; i < N_B * (n_r + 1); i++) {
             w_[i] = w[i];
         }
     }
 
-    inline Byte SBox(Byte x) {
-        return S_BOX[x >> 4][x & 0xf];
+    Byte SBox(Byte x) {
+        return S_BOX[x];
+    }
+
+    Status SubShiftMixColumn(Word column, int col) {
+        // Byte row of column col moves to column col - row in ShiftRows.
+        Status ret;
+        for (int row = 0; row < 4; row++) {
+            int target = (col - row) & 3;
+            ret.SetColumn(target, TE[row][column >> (24 - row * 8) & 0xff]);
+        }
+        return ret;
     }
 
     Word SubWord(Word x) {
@@ -315,7 +578,7 @@ namespace AESLib {
         return ret;
     }
 
-    inline Word RotWord(Word x) {
+    Word RotWord(Word x) {
         return x << 8 | x >> 24;
     }
 
@@ -469,6 +732,101 @@ namespace AESLib {
         } else {
             Log::Error("Full round test: failed");
         }
+
+        Status parsed;
+        if (input.ToHex() == "328831e0435a3137f6309807a88da234" &&
+            Status::FromHex(output.ToHex(), parsed) && parsed == output &&
+            Status::FromHex("328831E0435A3137F6309807A88DA234", parsed) && parsed == input &&
+            not Status::FromHex("3288", parsed) && not Status::FromHex(string(32, 'g'), parsed)) {
+            Log::Correct("Hex test: passed");
+        } else {
+            Log::Error("Hex test: failed");
+        }
+
+        Status by_column = {};
+        for (int col = 0; col < 4; col++) {
+            by_column += SubShiftMixColumn(start_of_round.Column(col), col);
+        }
+        if (by_column == after_mix_columns) {
+            Log::Correct("SubShiftMixColumn test: passed");
+        } else {
+            Log::Error("SubShiftMixColumn test: failed");
+        }
+
+        constexpr ByteMask diagonal = ByteMask::At(0, 0) | ByteMask::At(1, 1) |
+                                      ByteMask::At(2, 2) | ByteMask::At(3, 3);
+        static_assert(diagonal.ShiftRows() == ByteMask(0x000f));
+        static_assert(ByteMask::At(1, 2).Round() == ByteMask(0x00f0));
+        static_assert(diagonal.Round().Round() == ByteMask::All());
+
+        // The fast path is checked with every backend this CPU can run.
+        Backend default_backend = GetBackend();
+        for (Backend fast_backend: {Backend::Portable, Backend::AESNI}) {
+            if (fast_backend == Backend::AESNI && not HasAESNI()) {
+                Log::Warning("AES-NI is not supported, skip the AES-NI tests.");
+                continue;
+            }
+            SetBackend(fast_backend);
+            string name = fast_backend == Backend::AESNI ? "AES-NI" : "T-table";
+            x = start_of_round;
+            aes.RoundFast(x, 1);
+            if (x == result_of_round) {
+                Log::Correct(name + " round test: passed");
+            } else {
+                Log::Error(name + " round test: failed");
+            }
+            x = result_of_round;
+            aes.InvRoundFast(x, 1);
+            if (x == start_of_round) {
+                Log::Correct(name + " inverse round test: passed");
+            } else {
+                Log::Error(name + " inverse round test: failed");
+            }
+            if (aes.CipherFast(input) == output &&
+                aes.CompressionFunctionFast(input) == aes.CompressionFunction(input)) {
+                Log::Correct(name + " full round test: passed");
+            } else {
+                Log::Error(name + " full round test: failed");
+            }
+
+            // Walk through pseudo random states by repeatedly encrypting.
+            bool fast_equal_flag = true;
+            x = input;
+            for (int i = 0; i < 0x100; i++) {
+                x = aes.Cipher(x);
+                fast_equal_flag &= aes.CipherFast(x) == aes.Cipher(x);
+                for (int round = 1; round <= 10; round++) {
+                    Status y = x, z = x;
+                    aes.Round(y, round);
+                    aes.RoundFast(z, round);
+                    fast_equal_flag &= y == z;
+                    y = x, z = x;
+                    aes.InvRound(y, round);
+                    aes.InvRoundFast(z, round);
+                    fast_equal_flag &= y == z;
+                    y = x, z = x;
+                    aes.RoundFast(y, round);
+                    RoundFast(z, aes.RoundKey(round), round == 10);
+                    fast_equal_flag &= y == z;
+                    y = x, z = x;
+                    aes.InvRoundFast(y, round);
+                    InvRoundFast(z, aes.RoundKey(round), round == 10);
+                    fast_equal_flag &= y == z;
+                }
+                fast_equal_flag &= CompressionFunctionFast(x, &aes.RoundKey(0), 10) == aes.CompressionFunction(x);
+                for (int col = 0; col < 4; col++) {
+                    Word column = aes.CompressionFunction(x).Column(col);
+                    fast_equal_flag &= aes.CompressionColumnFast(x, col) == column;
+                    fast_equal_flag &= CompressionColumnFast(x, &aes.RoundKey(0), 10, col) == column;
+                }
+            }
+            if (fast_equal_flag) {
+                Log::Correct(name + " round equivalence test: passed");
+            } else {
+                Log::Error(name + " round equivalence test: failed");
+            }
+        }
+        SetBackend(default_backend);
     }
 
 } // AESLib
@@ -1,18 +1,48 @@
 #ifndef AESHASHMITM_AES_H
 #define AESHASHMITM_AES_H
 
+#include "gf.h"
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
 
 namespace AESLib {
-    typedef unsigned char Byte;
     typedef unsigned int Word;
 
     const int N_B = 4;  // Number of words per block (status). Always 4.
 
-    class Status {
+    // A status is stored column by column, the byte at row, col is
+    // value.data[col << 2 | row]. So every column is a contiguous word and the
+    // whole status is one aligned 128 bits value. value[row][col] still
+    // addresses the bytes by row and column.
+    class alignas(16) Status {
     public:
-        Byte value[N_B][4]{};
+        class Bytes {
+            template<typename T>
+            class Row {
+                T *base;
+            public:
+                explicit Row(T *base_) : base(base_) {}
+
+                T &operator[](int col) const {
+                    return base[col << 2];
+                }
+            };
+
+        public:
+            alignas(16) Byte data[16]{};
+
+            Row<Byte> operator[](int row) {
+                return Row<Byte>(data + row);
+            }
+
+            Row<const Byte> operator[](int row) const {
+                return Row<const Byte>(data + row);
+            }
+        };
+
+        Bytes value;
 
         Status();
 
@@ -20,13 +50,58 @@ namespace AESLib {
 
         Status(const std::initializer_list<Word> &words);
 
-        bool operator==(const Status &y) const;
+        bool operator==(const Status &y) const {
+            std::uint64_t x_0, x_1, y_0, y_1;
+            std::memcpy(&x_0, value.data, 8);
+            std::memcpy(&x_1, value.data + 8, 8);
+            std::memcpy(&y_0, y.value.data, 8);
+            std::memcpy(&y_1, y.value.data + 8, 8);
+            return ((x_0 ^ y_0) | (x_1 ^ y_1)) == 0;
+        }
+
+        void operator+=(const Status &y) {
+            std::uint64_t x_0, x_1, y_0, y_1;
+            std::memcpy(&x_0, value.data, 8);
+            std::memcpy(&x_1, value.data + 8, 8);
+            std::memcpy(&y_0, y.value.data, 8);
+            std::memcpy(&y_1, y.value.data + 8, 8);
+            x_0 ^= y_0;
+            x_1 ^= y_1;
+            std::memcpy(value.data, &x_0, 8);
+            std::memcpy(value.data + 8, &x_1, 8);
+        }
+
+        Status operator+(const Status &y) const {
+            Status ret = *this;
+            ret += y;
+            return ret;
+        }
+
+        // A column packed like the key schedule words, row 0 in the highest byte.
+        [[nodiscard]] Word Column(int col) const {
+            Word x;
+            std::memcpy(&x, value.data + (col << 2), 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            x = __builtin_bswap32(x);
+#endif
+            return x;
+        }
+
+        void SetColumn(int col, Word x) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            x = __builtin_bswap32(x);
+#endif
+            std::memcpy(value.data + (col << 2), &x, 4);
+        }
 
-        void operator+=(const Status &y);
+        [[nodiscard]] std::string ToString() const;
 
-        Status operator+(const Status &y);
+        // The bytes in the order of ToString, as one word of hex digits.
+        [[nodiscard]] std::string ToHex() const;
 
-        [[nodiscard]] std::string ToString() const;
+        // Read what ToHex writes. Returns false when text is not 32 hex
+        // digits.
+        static bool FromHex(const std::string &text, Status &status);
 
         void SubBytes();
 
@@ -41,10 +116,89 @@ namespace AESLib {
         void InvMixColumns();
     };
 
+    // A set of byte positions of a status, bit col << 2 | row for value[row][col]
+    // like the storage order. It follows which bytes can depend on some input
+    // bytes: SubBytes and AddRoundKey keep the set, ShiftRows moves it and
+    // MixColumns spreads it over whole columns.
+    class ByteMask {
+        std::uint16_t bits = 0;
+    public:
+        constexpr ByteMask() = default;
+
+        constexpr explicit ByteMask(std::uint16_t bits_) : bits(bits_) {}
+
+        static constexpr ByteMask At(int row, int col) {
+            return ByteMask((std::uint16_t) (1u << (col << 2 | row)));
+        }
+
+        static constexpr ByteMask All() {
+            return ByteMask(0xffff);
+        }
+
+        [[nodiscard]] constexpr std::uint16_t Bits() const {
+            return bits;
+        }
+
+        [[nodiscard]] constexpr bool Has(int row, int col) const {
+            return bits >> (col << 2 | row) & 1;
+        }
+
+        [[nodiscard]] constexpr bool HasColumn(int col) const {
+            return bits >> (col << 2) & 0xf;
+        }
+
+        constexpr ByteMask operator|(ByteMask y) const {
+            return ByteMask((std::uint16_t) (bits | y.bits));
+        }
+
+        constexpr bool operator==(ByteMask y) const {
+            return bits == y.bits;
+        }
+
+        [[nodiscard]] constexpr ByteMask ShiftRows() const {
+            ByteMask ret;
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    if (Has(row, col)) {
+                        ret = ret | At(row, (col - row + 4) & 3);
+                    }
+                }
+            }
+            return ret;
+        }
+
+        [[nodiscard]] constexpr ByteMask MixColumns() const {
+            ByteMask ret;
+            for (int col = 0; col < 4; col++) {
+                if (HasColumn(col)) {
+                    ret = ret | ByteMask((std::uint16_t) (0xf << (col << 2)));
+                }
+            }
+            return ret;
+        }
+
+        // SubBytes, ShiftRows, MixColumns and AddRoundKey.
+        [[nodiscard]] constexpr ByteMask Round() const {
+            return ShiftRows().MixColumns();
+        }
+    };
+
+    // Implementation behind the fast path of AES. It is chosen at startup
+    // through cpuid, and can be switched for tests and benchmarks.
+    enum class Backend {
+        Portable,   // T-tables.
+        AESNI,
+    };
+
+    [[nodiscard]] Backend GetBackend();
+
+    void SetBackend(Backend backend);
+
     class AES {
         int n_k = 4;    // Number of words per key. Can be 4, 6, 8.
         int n_r = 10;   // Number of round. Can be 10, 12, 14.
         Word w[60] = {};    // It is needed 60 word w for 14 round.
+        Status round_key[15];   // w in the layout of Status, for AddRoundKey.
     public:
         AES();
 
@@ -64,14 +218,43 @@ namespace AESLib {
 
         [[nodiscard]] Status CompressionFunction(Status status) const;
 
+        // Fast paths built on AES-NI or the T-tables, see Backend. They give the
+        // same results as the functions above, which stay as the reference
+        // implementation.
+
+        void RoundFast(Status &status, int round) const;
+
+        void InvRoundFast(Status &status, int round) const;
+
+        [[nodiscard]] Status CipherFast(Status status) const;
+
+        [[nodiscard]] Status CompressionFunctionFast(Status status) const;
+
+        // Column col of CompressionFunctionFast(status), as a cheap first
+        // check of candidates. The T-tables compute the last round for that
+        // column only; AES-NI computes everything, which costs no more.
+        [[nodiscard]] Word CompressionColumnFast(Status status, int col) const;
+
         void ReadW(Word *w_) const;
+
+        [[nodiscard]] const Status &RoundKey(int round) const {
+            return round_key[round];
+        }
     };
 
-    Byte GFMul(Byte x, Byte y);
+    // The fast paths of AES on explicit round keys in the layout of
+    // AES::RoundKey, for callers which keep compact tables of round keys
+    // instead of AES objects.
 
-    void GFMatrixMul(Byte x[4][4], Byte y[4][4], Byte ret[4][4]);
+    void RoundFast(Status &status, const Status &round_key, bool last_round);
 
-    Byte GFInvSlow(Byte x);
+    void InvRoundFast(Status &status, const Status &round_key, bool last_round);
+
+    [[nodiscard]] Status CompressionFunctionFast(const Status &status, const Status *round_key, int n_r);
+
+    [[nodiscard]] Word CompressionColumnFast(const Status &status, const Status *round_key, int n_r, int col);
+
+    void GFMatrixMul(const Byte x[4][4], const Byte y[4][4], Byte ret[4][4]);
 
     Byte ByteInWord(Word x, int y);
 
@@ -79,6 +262,12 @@ namespace AESLib {
 
     Byte SBox(Byte x);
 
+    // The part of MixColumns(ShiftRows(SubBytes(x))) which comes from column
+    // col of x, given as a word. MixColumns is linear, so the whole result is
+    // the sum of the parts of the 4 columns. It costs 4 T-table lookups, and
+    // lets a caller update a round output when only one input column changes.
+    [[nodiscard]] Status SubShiftMixColumn(Word column, int col);
+
     Word SubWord(Word x);
 
     Word InvSubWord(Word x);
@@ -89,42 +278,31 @@ namespace AESLib {
 
     void AESTest();
 
-    const Byte S_BOX[16][16] = {
-            {0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76},
-            {0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0},
-            {0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15},
-            {0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75},
-            {0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84},
-            {0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf},
-            {0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8},
-            {0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2},
-            {0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73},
-            {0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb},
-            {0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79},
-            {0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08},
-            {0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a},
-            {0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e},
-            {0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf},
-            {0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16},
-    };
-    const Byte INV_S_BOX[16][16] = {
-            {0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb},
-            {0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb},
-            {0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e},
-            {0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25},
-            {0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92},
-            {0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84},
-            {0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06},
-            {0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b},
-            {0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73},
-            {0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e},
-            {0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0xe,  0xaa, 0x18, 0xbe, 0x1b},
-            {0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4},
-            {0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f},
-            {0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef},
-            {0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61},
-            {0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d}
-    };
+    constexpr Byte RotateLeft(Byte x, int n) {
+        return (Byte) (x << n | x >> (8 - n));
+    }
+
+    constexpr std::array<Byte, 256> MakeSBox() {
+        // Inversion in GF(2^8) followed by the affine transformation of
+        // FIPS 197 section 5.1.1.
+        std::array<Byte, 256> ret = {};
+        for (int x = 0; x < 0x100; x++) {
+            Byte b = GF_INV[x];
+            ret[x] = b ^ RotateLeft(b, 1) ^ RotateLeft(b, 2) ^ RotateLeft(b, 3) ^ RotateLeft(b, 4) ^ 0x63;
+        }
+        return ret;
+    }
+
+    constexpr std::array<Byte, 256> MakeInvSBox(const std::array<Byte, 256> &s_box) {
+        std::array<Byte, 256> ret = {};
+        for (int x = 0; x < 0x100; x++) {
+            ret[s_box[x]] = (Byte) x;
+        }
+        return ret;
+    }
+
+    inline constexpr std::array<Byte, 256> S_BOX = MakeSBox();
+    inline constexpr std::array<Byte, 256> INV_S_BOX = MakeInvSBox(S_BOX);
 
 } // AESLib
 
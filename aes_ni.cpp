@@ -0,0 +1,81 @@
+#include "aes_ni.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include "simd_status.h"
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AES_NI_TARGET __attribute__((target("aes,ssse3")))
+
+namespace AESLib {
+    bool HasAESNI() {
+        unsigned int eax, ebx, ecx, edx;
+        if (not __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (ecx & bit_AES) && (ecx & bit_SSSE3);
+    }
+
+    AES_NI_TARGET static inline __m128i Encrypt(__m128i x, const Status *round_key, int n_r) {
+        x = _mm_xor_si128(x, LoadStatus(round_key[0]));
+        for (int round = 1; round < n_r; round++) {
+            x = _mm_aesenc_si128(x, LoadStatus(round_key[round]));
+        }
+        return _mm_aesenclast_si128(x, LoadStatus(round_key[n_r]));
+    }
+
+    AES_NI_TARGET void AESNIRound(Status &status, const Status &key, bool last_round) {
+        __m128i x = LoadStatus(status);
+        if (last_round) {
+            x = _mm_aesenclast_si128(x, LoadStatus(key));
+        } else {
+            x = _mm_aesenc_si128(x, LoadStatus(key));
+        }
+        StoreStatus(status, x);
+    }
+
+    AES_NI_TARGET void AESNIInvRound(Status &status, const Status &key, bool last_round) {
+        // aesdeclast with a zero key is exactly InvShiftRows and InvSubBytes.
+        __m128i x = _mm_xor_si128(LoadStatus(status), LoadStatus(key));
+        if (not last_round) {
+            x = _mm_aesimc_si128(x);
+        }
+        StoreStatus(status, _mm_aesdeclast_si128(x, _mm_setzero_si128()));
+    }
+
+    AES_NI_TARGET Status AESNICipher(const Status &status, const Status *round_key, int n_r) {
+        Status ret;
+        StoreStatus(ret, Encrypt(LoadStatus(status), round_key, n_r));
+        return ret;
+    }
+
+    AES_NI_TARGET Status AESNICompressionFunction(const Status &status, const Status *round_key, int n_r) {
+        __m128i x = LoadStatus(status);
+        Status ret;
+        StoreStatus(ret, _mm_xor_si128(Encrypt(x, round_key, n_r), x));
+        return ret;
+    }
+} // AESLib
+
+#else
+
+namespace AESLib {
+    bool HasAESNI() {
+        return false;
+    }
+
+    void AESNIRound(Status &, const Status &, bool) {}
+
+    void AESNIInvRound(Status &, const Status &, bool) {}
+
+    Status AESNICipher(const Status &status, const Status *, int) {
+        return status;
+    }
+
+    Status AESNICompressionFunction(const Status &status, const Status *, int) {
+        return status;
+    }
+} // AESLib
+
+#endif
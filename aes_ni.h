@@ -0,0 +1,22 @@
+#ifndef AESHASHMITM_AES_NI_H
+#define AESHASHMITM_AES_NI_H
+
+#include "aes.h"
+
+namespace AESLib {
+    // AES-NI kernels for the fast path of AES. The keys are the round keys of
+    // AES in the layout of Status, which is the byte order of __m128i.
+    // They must only be called when HasAESNI() is true.
+
+    [[nodiscard]] bool HasAESNI();
+
+    void AESNIRound(Status &status, const Status &key, bool last_round);
+
+    void AESNIInvRound(Status &status, const Status &key, bool last_round);
+
+    [[nodiscard]] Status AESNICipher(const Status &status, const Status *round_key, int n_r);
+
+    [[nodiscard]] Status AESNICompressionFunction(const Status &status, const Status *round_key, int n_r);
+} // AESLib
+
+#endif //AESHASHMITM_AES_NI_H
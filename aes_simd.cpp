@@ -0,0 +1,366 @@
+#include "aes_simd.h"
+
+#include "log.h"
+#include <atomic>
+#include <string>
+
+namespace AESLib {
+    static_assert(sizeof(Status) == 16, "The wide kernels load statuses from arrays.");
+
+    Word ColumnForm::Scalar(const Status &status) const {
+        Word ret = 0;
+        for (int col = 0; col < 4; col++) {
+            Byte temp = 0;
+            for (int row = 0; row < 4; row++) {
+                temp ^= GFMul(coef[row][col], status.value[row][col]);
+            }
+            ret = ret << 8 | temp;
+        }
+        return ret;
+    }
+
+    ColumnForm::ColumnForm(const Byte (&coef_)[4][4]) {
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                coef[row][col] = coef_[row][col];
+            }
+        }
+        Init();
+    }
+
+    void ColumnForm::Init() {
+        Byte factors[16] = {};
+        n_factor = 0;
+        for (int col = 0; col < 4; col++) {
+            for (int row = 0; row < 4; row++) {
+                Byte factor = coef[row][col];
+                if (factor == 0) {
+                    continue;
+                }
+                int k = 0;
+                while (k < n_factor && factors[k] != factor) {
+                    k++;
+                }
+                if (k == n_factor) {
+                    factors[n_factor++] = factor;
+                    for (int x = 0; x < 0x10; x++) {
+                        low[k][x] = GFMul(factor, x);
+                        high[k][x] = GFMul(factor, x << 4);
+                    }
+                }
+                mask[k][col << 2 | row] = 0xff;
+            }
+        }
+    }
+} // AESLib
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include "simd_status.h"
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+namespace AESLib {
+    SIMDLevel GetSupportedSIMDLevel() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return SIMDLevel::AVX512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            return SIMDLevel::AVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            return SIMDLevel::SSSE3;
+        }
+        return SIMDLevel::Scalar;
+    }
+
+    constexpr std::array<std::array<Byte, 16>, 2> MakeNibbleTable(Byte factor) {
+        std::array<std::array<Byte, 16>, 2> ret = {};
+        for (int x = 0; x < 0x10; x++) {
+            ret[0][x] = GF_MUL[factor][x];
+            ret[1][x] = GF_MUL[factor][x << 4];
+        }
+        return ret;
+    }
+
+    alignas(16) static constexpr std::array<std::array<Byte, 16>, 2> MUL_E = MakeNibbleTable(0xe);
+    alignas(16) static constexpr std::array<std::array<Byte, 16>, 2> MUL_B = MakeNibbleTable(0xb);
+    alignas(16) static constexpr std::array<std::array<Byte, 16>, 2> MUL_D = MakeNibbleTable(0xd);
+    alignas(16) static constexpr std::array<std::array<Byte, 16>, 2> MUL_9 = MakeNibbleTable(0x9);
+
+    SSSE3_TARGET static inline __m128i NibbleMul(__m128i x, const Byte *low, const Byte *high) {
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        __m128i l = _mm_shuffle_epi8(_mm_load_si128((const __m128i *) low), _mm_and_si128(x, nibble));
+        __m128i h = _mm_shuffle_epi8(_mm_load_si128((const __m128i *) high),
+                                     _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+        return _mm_xor_si128(l, h);
+    }
+
+    SSSE3_TARGET static inline __m128i NibbleMul(
+            __m128i x, const std::array<std::array<Byte, 16>, 2> &table
+    ) {
+        return NibbleMul(x, table[0].data(), table[1].data());
+    }
+
+    SSSE3_TARGET static inline __m128i XTime(__m128i x) {
+        __m128i reduce = _mm_and_si128(_mm_cmplt_epi8(x, _mm_setzero_si128()), _mm_set1_epi8(0x1b));
+        return _mm_xor_si128(_mm_add_epi8(x, x), reduce);
+    }
+
+    // Row r of the result holds row r + n of x, in every column.
+    SSSE3_TARGET static inline __m128i RotateRows1(__m128i x) {
+        return _mm_shuffle_epi8(x, _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+    }
+
+    SSSE3_TARGET static inline __m128i RotateRows2(__m128i x) {
+        return _mm_shuffle_epi8(x, _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+    }
+
+    SSSE3_TARGET static inline __m128i RotateRows3(__m128i x) {
+        return _mm_shuffle_epi8(x, _mm_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14));
+    }
+
+    SSSE3_TARGET void SIMDMixColumns(Status &status) {
+        // b_r = 2 * (a_r + a_{r+1}) + a_{r+1} + a_{r+2} + a_{r+3}.
+        __m128i x = LoadStatus(status);
+        __m128i x_1 = RotateRows1(x);
+        __m128i ret = _mm_xor_si128(XTime(_mm_xor_si128(x, x_1)), x_1);
+        ret = _mm_xor_si128(ret, _mm_xor_si128(RotateRows2(x), RotateRows3(x)));
+        StoreStatus(status, ret);
+    }
+
+    SSSE3_TARGET void SIMDInvMixColumns(Status &status) {
+        // b_r = e * a_r + b * a_{r+1} + d * a_{r+2} + 9 * a_{r+3}.
+        __m128i x = LoadStatus(status);
+        __m128i ret = _mm_xor_si128(NibbleMul(x, MUL_E), NibbleMul(RotateRows1(x), MUL_B));
+        ret = _mm_xor_si128(ret, NibbleMul(RotateRows2(x), MUL_D));
+        ret = _mm_xor_si128(ret, NibbleMul(RotateRows3(x), MUL_9));
+        StoreStatus(status, ret);
+    }
+
+    // The kernels of ColumnForm. The products are summed inside each column,
+    // which leaves the result of the column in its row 0, and the 4 results
+    // are gathered into the low 32 bits with column 0 in the highest byte.
+
+    SSSE3_TARGET static Word ColumnForm128(
+            const Status &status, int n_factor,
+            const Byte (*low)[16], const Byte (*high)[16], const Byte (*mask)[16]
+    ) {
+        __m128i x = LoadStatus(status);
+        __m128i sum = _mm_setzero_si128();
+        for (int k = 0; k < n_factor; k++) {
+            __m128i product = NibbleMul(x, low[k], high[k]);
+            sum = _mm_xor_si128(sum, _mm_and_si128(product, _mm_load_si128((const __m128i *) mask[k])));
+        }
+        sum = _mm_xor_si128(sum, _mm_srli_epi32(sum, 16));
+        sum = _mm_xor_si128(sum, _mm_srli_epi32(sum, 8));
+        const __m128i gather = _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        return (Word) _mm_cvtsi128_si32(_mm_shuffle_epi8(sum, gather));
+    }
+
+    AVX2_TARGET static void ColumnForm256(
+            const Status *statuses, Word *ret, int n_factor,
+            const Byte (*low)[16], const Byte (*high)[16], const Byte (*mask)[16]
+    ) {
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        __m256i x = _mm256_loadu_si256((const __m256i *) statuses);
+        __m256i x_low = _mm256_and_si256(x, nibble);
+        __m256i x_high = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < n_factor; k++) {
+            __m256i l = _mm256_shuffle_epi8(
+                    _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) low[k])), x_low);
+            __m256i h = _mm256_shuffle_epi8(
+                    _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) high[k])), x_high);
+            __m256i m = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) mask[k]));
+            sum = _mm256_xor_si256(sum, _mm256_and_si256(_mm256_xor_si256(l, h), m));
+        }
+        sum = _mm256_xor_si256(sum, _mm256_srli_epi32(sum, 16));
+        sum = _mm256_xor_si256(sum, _mm256_srli_epi32(sum, 8));
+        const __m256i gather = _mm256_broadcastsi128_si256(
+                _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+        sum = _mm256_shuffle_epi8(sum, gather);
+        ret[0] = (Word) _mm256_extract_epi32(sum, 0);
+        ret[1] = (Word) _mm256_extract_epi32(sum, 4);
+    }
+
+    // GCC fills the pass-through lanes of the unmasked AVX-512 intrinsics
+    // from _mm512_undefined_epi32, which -Wall reports as uninitialized. The
+    // zero-masked forms with every lane selected compile to the same
+    // instructions without it.
+    const __mmask16 ALL_LANES = 0xffff;
+
+    AVX512_TARGET static inline __m512i Broadcast512(const Byte *x) {
+        return _mm512_maskz_broadcast_i32x4(ALL_LANES, _mm_load_si128((const __m128i *) x));
+    }
+
+    AVX512_TARGET static void ColumnForm512(
+            const Status *statuses, Word *ret, int n_factor,
+            const Byte (*low)[16], const Byte (*high)[16], const Byte (*mask)[16]
+    ) {
+        const __m512i nibble = _mm512_set1_epi8(0x0f);
+        __m512i x = _mm512_loadu_si512((const void *) statuses);
+        __m512i x_low = _mm512_and_si512(x, nibble);
+        __m512i x_high = _mm512_and_si512(_mm512_srli_epi16(x, 4), nibble);
+        __m512i sum = _mm512_setzero_si512();
+        for (int k = 0; k < n_factor; k++) {
+            __m512i l = _mm512_shuffle_epi8(Broadcast512(low[k]), x_low);
+            __m512i h = _mm512_shuffle_epi8(Broadcast512(high[k]), x_high);
+            __m512i m = Broadcast512(mask[k]);
+            sum = _mm512_xor_si512(sum, _mm512_and_si512(_mm512_xor_si512(l, h), m));
+        }
+        sum = _mm512_xor_si512(sum, _mm512_maskz_srli_epi32(ALL_LANES, sum, 16));
+        sum = _mm512_xor_si512(sum, _mm512_maskz_srli_epi32(ALL_LANES, sum, 8));
+        alignas(16) static const Byte gather[16] = {12, 8, 4, 0, 0x80, 0x80, 0x80, 0x80,
+                                                     0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80};
+        sum = _mm512_shuffle_epi8(sum, Broadcast512(gather));
+        alignas(64) Word lanes[16];
+        _mm512_store_si512((void *) lanes, sum);
+        for (int i = 0; i < 4; i++) {
+            ret[i] = lanes[i << 2];
+        }
+    }
+
+    // Read by every worker in the kernels, see the backend in aes.cpp.
+    static std::atomic<SIMDLevel> simd_level(GetSupportedSIMDLevel());
+
+    Word ColumnForm::operator()(const Status &status) const {
+        if (GetSIMDLevel() == SIMDLevel::Scalar) {
+            return Scalar(status);
+        }
+        return ColumnForm128(status, n_factor, low, high, mask);
+    }
+
+    void ColumnForm::operator()(const Status *statuses, int n, Word *ret) const {
+        int i = 0;
+        SIMDLevel level = GetSIMDLevel();
+        if (level == SIMDLevel::AVX512) {
+            for (; i + 4 <= n; i += 4) {
+                ColumnForm512(statuses + i, ret + i, n_factor, low, high, mask);
+            }
+        }
+        if (level >= SIMDLevel::AVX2) {
+            for (; i + 2 <= n; i += 2) {
+                ColumnForm256(statuses + i, ret + i, n_factor, low, high, mask);
+            }
+        }
+        for (; i < n; i++) {
+            ret[i] = (*this)(statuses[i]);
+        }
+    }
+} // AESLib
+
+#else
+
+namespace AESLib {
+    SIMDLevel GetSupportedSIMDLevel() {
+        return SIMDLevel::Scalar;
+    }
+
+    void SIMDMixColumns(Status &) {}
+
+    void SIMDInvMixColumns(Status &) {}
+
+    static std::atomic<SIMDLevel> simd_level(SIMDLevel::Scalar);
+
+    Word ColumnForm::operator()(const Status &status) const {
+        return Scalar(status);
+    }
+
+    void ColumnForm::operator()(const Status *statuses, int n, Word *ret) const {
+        for (int i = 0; i < n; i++) {
+            ret[i] = Scalar(statuses[i]);
+        }
+    }
+} // AESLib
+
+#endif
+
+namespace AESLib {
+    SIMDLevel GetSIMDLevel() {
+        return simd_level.load(std::memory_order_relaxed);
+    }
+
+    void SetSIMDLevel(SIMDLevel level) {
+        if (level > GetSupportedSIMDLevel()) {
+            Log::Warning("The SIMD level is not supported, keep the current one.");
+            return;
+        }
+        simd_level.store(level, std::memory_order_relaxed);
+    }
+
+    void SIMDTest() {
+        Byte mix_columns[4][4] = {
+                0x2, 0x3, 0x1, 0x1,
+                0x1, 0x2, 0x3, 0x1,
+                0x1, 0x1, 0x2, 0x3,
+                0x3, 0x1, 0x1, 0x2,
+        };
+        Byte inv_mix_columns[4][4] = {
+                0xe, 0xb, 0xd, 0x9,
+                0x9, 0xe, 0xb, 0xd,
+                0xd, 0x9, 0xe, 0xb,
+                0xb, 0xd, 0x9, 0xe,
+        };
+        Byte coef[4][4] = {
+                0x00, 0x07, 0x05, 0x01,
+                0x0d, 0x00, 0x0e, 0x05,
+                0x05, 0x01, 0x00, 0x9a,
+                0x07, 0x05, 0x01, 0x00,
+        };
+        ColumnForm form(coef);
+
+        // Walk through pseudo random states by repeatedly encrypting.
+        Byte key[16] = {};
+        AES aes(key);
+        const int n = 0x101;
+        Status statuses[n];
+        for (int i = 1; i < n; i++) {
+            statuses[i] = aes.Cipher(statuses[i - 1]);
+        }
+
+        SIMDLevel default_level = GetSIMDLevel();
+        const char *names[] = {"Scalar", "SSSE3", "AVX2", "AVX-512"};
+        for (int level = 0; level <= (int) GetSupportedSIMDLevel(); level++) {
+            SetSIMDLevel((SIMDLevel) level);
+            bool mix_columns_flag = true;
+            bool form_flag = true;
+            Word batch[n];
+            form(statuses, n, batch);
+            for (int i = 0; i < n; i++) {
+                Byte a[4][4], b[4][4], c[4][4];
+                for (int row = 0; row < 4; row++) {
+                    for (int col = 0; col < 4; col++) {
+                        a[row][col] = statuses[i].value[row][col];
+                    }
+                }
+                GFMatrixMul(mix_columns, a, b);
+                GFMatrixMul(inv_mix_columns, a, c);
+                Status x = statuses[i], y = statuses[i];
+                x.MixColumns();
+                y.InvMixColumns();
+                for (int row = 0; row < 4; row++) {
+                    for (int col = 0; col < 4; col++) {
+                        mix_columns_flag &= x.value[row][col] == b[row][col];
+                        mix_columns_flag &= y.value[row][col] == c[row][col];
+                    }
+                }
+                form_flag &= form(statuses[i]) == form.Scalar(statuses[i]);
+                form_flag &= batch[i] == form.Scalar(statuses[i]);
+            }
+            std::string name = names[level];
+            if (mix_columns_flag) {
+                Log::Correct(name + " MixColumns test: passed");
+            } else {
+                Log::Error(name + " MixColumns test: failed");
+            }
+            if (form_flag) {
+                Log::Correct(name + " column form test: passed");
+            } else {
+                Log::Error(name + " column form test: failed");
+            }
+        }
+        SetSIMDLevel(default_level);
+    }
+} // AESLib
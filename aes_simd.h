@@ -0,0 +1,72 @@
+#ifndef AESHASHMITM_AES_SIMD_H
+#define AESHASHMITM_AES_SIMD_H
+
+#include "aes.h"
+
+namespace AESLib {
+    // The widest vector kernels which MixColumns and ColumnForm use. It is
+    // chosen at startup through cpuid, and can be lowered for tests and
+    // benchmarks.
+    enum class SIMDLevel {
+        Scalar,
+        SSSE3,  // One status per __m128i.
+        AVX2,   // Two statuses per __m256i.
+        AVX512, // Four statuses per __m512i, needs AVX-512 BW.
+    };
+
+    [[nodiscard]] SIMDLevel GetSupportedSIMDLevel();
+
+    [[nodiscard]] SIMDLevel GetSIMDLevel();
+
+    void SetSIMDLevel(SIMDLevel level);
+
+    // pshufb kernels of Status::MixColumns and Status::InvMixColumns.
+    // They must only be called when the SIMD level is SSSE3 or above.
+
+    void SIMDMixColumns(Status &status);
+
+    void SIMDInvMixColumns(Status &status);
+
+    // A linear form on each column: byte col of the result is
+    // sum_i coef[i][col] * value[i][col], with column 0 in the highest byte.
+    // ForwardMatch and BackwardMatch of the attacks are such forms, so they
+    // can share these kernels. Every distinct factor costs two pshufb on
+    // nibble tables.
+    class ColumnForm {
+        Byte coef[4][4] = {};
+        int n_factor = 0;
+        alignas(16) Byte low[16][16] = {};  // factor * x for x < 0x10.
+        alignas(16) Byte high[16][16] = {}; // factor * (x << 4) for x < 0x10.
+        alignas(16) Byte mask[16][16] = {}; // Where the factor is used, in __m128i byte order.
+
+        void Init();
+
+    public:
+        explicit ColumnForm(const Byte (&coef_)[4][4]);
+
+        // Build the form from a function which computes one column of it,
+        // such as ForwardMatch(status, col). The function has to be linear.
+        template<typename F>
+        explicit ColumnForm(F column_function) {
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    Status unit = {};
+                    unit.value[row][col] = 1;
+                    coef[row][col] = column_function(unit, col);
+                }
+            }
+            Init();
+        }
+
+        [[nodiscard]] Word operator()(const Status &status) const;
+
+        // Evaluate n statuses, using the wide kernels when they are available.
+        void operator()(const Status *statuses, int n, Word *ret) const;
+
+        [[nodiscard]] Word Scalar(const Status &status) const;
+    };
+
+    void SIMDTest();
+} // AESLib
+
+#endif //AESHASHMITM_AES_SIMD_H
@@ -0,0 +1,122 @@
+#include "batch_aes.h"
+
+#include "log.h"
+#include <string>
+
+namespace AESLib {
+    template<int LANES>
+    static bool BatchSubBytesTest() {
+        // Every S-box input appears in some lane and some byte.
+        for (int base = 0; base < 0x100; base += LANES) {
+            BatchStatus<LANES> batch;
+            for (int lane = 0; lane < LANES; lane++) {
+                Status status;
+                for (int row = 0; row < 4; row++) {
+                    for (int col = 0; col < 4; col++) {
+                        status.value[row][col] = (Byte) (base + lane + row * 4 + col);
+                    }
+                }
+                batch.Set(lane, status);
+            }
+            batch.SubBytes();
+            for (int lane = 0; lane < LANES; lane++) {
+                Status status = batch.Get(lane);
+                for (int row = 0; row < 4; row++) {
+                    for (int col = 0; col < 4; col++) {
+                        if (status.value[row][col] != SBox((Byte) (base + lane + row * 4 + col))) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    template<int LANES>
+    static bool BatchRoundTest(const AES &aes) {
+        // Walk through pseudo random states by repeatedly encrypting.
+        Status x = {};
+        Status statuses[LANES];
+        BatchStatus<LANES> batch;
+        for (int lane = 0; lane < LANES; lane++) {
+            x = aes.Cipher(x);
+            statuses[lane] = x;
+            batch.Set(lane, x);
+        }
+        for (int round = 1; round <= 10; round++) {
+            batch.Round(aes, round, round == 10);
+            for (auto &status: statuses) {
+                aes.Round(status, round);
+            }
+        }
+        for (int lane = 0; lane < LANES; lane++) {
+            if (not(batch.Get(lane) == statuses[lane])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<int LANES>
+    static bool BatchLoadStoreTest(const AES &aes) {
+        // Load and Store through the transposes agree with Set and Get lane
+        // by lane, and a Load followed by a Store gives the statuses back.
+        Status x = {};
+        Status statuses[LANES];
+        BatchStatus<LANES> set;
+        for (int lane = 0; lane < LANES; lane++) {
+            x = aes.Cipher(x);
+            statuses[lane] = x;
+            set.Set(lane, x);
+        }
+        BatchStatus<LANES> loaded;
+        loaded.Load(statuses);
+        Status stored[LANES];
+        loaded.Store(stored);
+        Status set_stored[LANES];
+        set.Store(set_stored);
+        for (int lane = 0; lane < LANES; lane++) {
+            if (not(stored[lane] == statuses[lane]) || not(loaded.Get(lane) == statuses[lane]) ||
+                not(set_stored[lane] == statuses[lane])) {
+                return false;
+            }
+        }
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                for (int i = 0; i < 8; i++) {
+                    if (loaded.bits[row][col][i] != set.bits[row][col][i]) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void BatchTest() {
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key);
+
+        if (BatchSubBytesTest<32>() && BatchSubBytesTest<64>()) {
+            Log::Correct("Batch SubBytes test: passed");
+        } else {
+            Log::Error("Batch SubBytes test: failed");
+        }
+        if (BatchRoundTest<32>(aes) && BatchRoundTest<64>(aes)) {
+            Log::Correct("Batch round test: passed");
+        } else {
+            Log::Error("Batch round test: failed");
+        }
+        if (BatchLoadStoreTest<32>(aes) && BatchLoadStoreTest<64>(aes)) {
+            Log::Correct("Batch load and store test: passed");
+        } else {
+            Log::Error("Batch load and store test: failed");
+        }
+    }
+} // AESLib
@@ -0,0 +1,352 @@
+#ifndef AESHASHMITM_BATCH_AES_H
+#define AESHASHMITM_BATCH_AES_H
+
+#include "aes.h"
+#include <cstdint>
+#include <type_traits>
+
+namespace AESLib {
+    // Bitsliced batch of LANES statuses. bits[row][col][i] holds the bit i of
+    // value[row][col] for every lane, lane k in bit k of the word. Operations
+    // work on all lanes at once and never index a table by data, so SubBytes
+    // is a boolean circuit instead of S-box lookups.
+    //
+    // No attack uses it: the forward chunks of the MITM attacks run on the
+    // fast paths of AES, see AES::RoundFast.
+    template<int LANES>
+    class BatchStatus {
+        static_assert(LANES == 32 || LANES == 64, "LANES can be 32 or 64.");
+    public:
+        typedef std::conditional_t<LANES == 64, std::uint64_t, std::uint32_t> Lane;
+
+        Lane bits[4][4][8]{};
+
+        BatchStatus() = default;
+
+        // Every lane starts as status.
+        explicit BatchStatus(const Status &status) {
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    for (int i = 0; i < 8; i++) {
+                        bits[row][col][i] = (Lane) 0 - (status.value[row][col] >> i & 1);
+                    }
+                }
+            }
+        }
+
+        void Set(int lane, const Status &status) {
+            const Lane mask = (Lane) 1 << lane;
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    Byte x = status.value[row][col];
+                    for (int i = 0; i < 8; i++) {
+                        bits[row][col][i] = (bits[row][col][i] & ~mask) | (Lane) (x >> i & 1) << lane;
+                    }
+                }
+            }
+        }
+
+        // Set only one byte of a lane, used to put the neutral bytes in.
+        void SetByte(int lane, int row, int col, Byte x) {
+            const Lane mask = (Lane) 1 << lane;
+            for (int i = 0; i < 8; i++) {
+                bits[row][col][i] = (bits[row][col][i] & ~mask) | (Lane) (x >> i & 1) << lane;
+            }
+        }
+
+        [[nodiscard]] Byte GetByte(int lane, int row, int col) const {
+            Byte ret = 0;
+            for (int i = 0; i < 8; i++) {
+                ret |= (Byte) ((bits[row][col][i] >> lane & 1) << i);
+            }
+            return ret;
+        }
+
+        [[nodiscard]] Status Get(int lane) const {
+            Status ret;
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    ret.value[row][col] = GetByte(lane, row, col);
+                }
+            }
+            return ret;
+        }
+
+        // Load and Store move all lanes at once. Each group of 8 lanes of one
+        // byte is an 8x8 bit matrix, which is transposed in a 64 bits word.
+        void Load(const Status *statuses) {
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    Lane *plane = bits[row][col];
+                    for (int i = 0; i < 8; i++) {
+                        plane[i] = 0;
+                    }
+                    for (int group = 0; group < LANES; group += 8) {
+                        std::uint64_t x = 0;
+                        for (int j = 0; j < 8; j++) {
+                            x |= (std::uint64_t) statuses[group + j].value[row][col] << (j * 8);
+                        }
+                        x = Transpose8x8(x);
+                        for (int i = 0; i < 8; i++) {
+                            plane[i] |= (Lane) (x >> (i * 8) & 0xff) << group;
+                        }
+                    }
+                }
+            }
+        }
+
+        void Store(Status *statuses) const {
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    const Lane *plane = bits[row][col];
+                    for (int group = 0; group < LANES; group += 8) {
+                        std::uint64_t x = 0;
+                        for (int i = 0; i < 8; i++) {
+                            x |= (std::uint64_t) (plane[i] >> group & 0xff) << (i * 8);
+                        }
+                        x = Transpose8x8(x);
+                        for (int j = 0; j < 8; j++) {
+                            statuses[group + j].value[row][col] = (Byte) (x >> (j * 8));
+                        }
+                    }
+                }
+            }
+        }
+
+        // Add the same status to every lane.
+        void operator+=(const Status &y) {
+            for (int row = 0; row < 4; row++) {
+                for (int col = 0; col < 4; col++) {
+                    for (int i = 0; i < 8; i++) {
+                        bits[row][col][i] ^= (Lane) 0 - (y.value[row][col] >> i & 1);
+                    }
+                }
+            }
+        }
+
+        void AddRoundKey(const AES &aes, int round) {
+            *this += aes.RoundKey(round);
+        }
+
+        void SubBytes() {
+            for (auto &row: bits) {
+                for (auto &byte: row) {
+                    SBoxCircuit(byte);
+                }
+            }
+        }
+
+        void ShiftRows() {
+            for (int row = 1; row < 4; row++) {
+                Lane temp[4][8];
+                for (int col = 0; col < 4; col++) {
+                    for (int i = 0; i < 8; i++) {
+                        temp[col][i] = bits[row][(col + row) & 3][i];
+                    }
+                }
+                for (int col = 0; col < 4; col++) {
+                    for (int i = 0; i < 8; i++) {
+                        bits[row][col][i] = temp[col][i];
+                    }
+                }
+            }
+        }
+
+        void MixColumns() {
+            // b_r = 2 * (a_r + a_{r+1}) + a_{r+1} + a_{r+2} + a_{r+3}.
+            for (int col = 0; col < 4; col++) {
+                Lane a[4][8];
+                for (int row = 0; row < 4; row++) {
+                    for (int i = 0; i < 8; i++) {
+                        a[row][i] = bits[row][col][i];
+                    }
+                }
+                for (int row = 0; row < 4; row++) {
+                    const Lane *a_0 = a[row];
+                    const Lane *a_1 = a[(row + 1) & 3];
+                    const Lane *a_2 = a[(row + 2) & 3];
+                    const Lane *a_3 = a[(row + 3) & 3];
+                    Lane t[8];
+                    for (int i = 0; i < 8; i++) {
+                        t[i] = a_0[i] ^ a_1[i];
+                    }
+                    Lane *b = bits[row][col];
+                    b[0] = t[7];
+                    b[1] = t[0] ^ t[7];
+                    b[2] = t[1];
+                    b[3] = t[2] ^ t[7];
+                    b[4] = t[3] ^ t[7];
+                    b[5] = t[4];
+                    b[6] = t[5];
+                    b[7] = t[6];
+                    for (int i = 0; i < 8; i++) {
+                        b[i] ^= a_1[i] ^ a_2[i] ^ a_3[i];
+                    }
+                }
+            }
+        }
+
+        void Round(const AES &aes, int round, bool last_round = false) {
+            SubBytes();
+            ShiftRows();
+            if (not last_round)
+                MixColumns();
+            AddRoundKey(aes, round);
+        }
+
+    private:
+        static std::uint64_t Transpose8x8(std::uint64_t x) {
+            // Bit j of byte i goes to bit i of byte j.
+            std::uint64_t t;
+            t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+            x ^= t ^ (t << 7);
+            t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+            x ^= t ^ (t << 14);
+            t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+            x ^= t ^ (t << 28);
+            return x;
+        }
+
+        static void SBoxCircuit(Lane *q) {
+            // The S-box circuit of Boyar and Peralta, 113 gates. q[i] is bit i.
+            Lane x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+            Lane x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+            // Top linear transformation.
+            Lane y14 = x3 ^ x5;
+            Lane y13 = x0 ^ x6;
+            Lane y9 = x0 ^ x3;
+            Lane y8 = x0 ^ x5;
+            Lane t0 = x1 ^ x2;
+            Lane y1 = t0 ^ x7;
+            Lane y4 = y1 ^ x3;
+            Lane y12 = y13 ^ y14;
+            Lane y2 = y1 ^ x0;
+            Lane y5 = y1 ^ x6;
+            Lane y3 = y5 ^ y8;
+            Lane t1 = x4 ^ y12;
+            Lane y15 = t1 ^ x5;
+            Lane y20 = t1 ^ x1;
+            Lane y6 = y15 ^ x7;
+            Lane y10 = y15 ^ t0;
+            Lane y11 = y20 ^ y9;
+            Lane y7 = x7 ^ y11;
+            Lane y17 = y10 ^ y11;
+            Lane y19 = y10 ^ y8;
+            Lane y16 = t0 ^ y11;
+            Lane y21 = y13 ^ y16;
+            Lane y18 = x0 ^ y16;
+
+            // Non-linear section.
+            Lane t2 = y12 & y15;
+            Lane t3 = y3 & y6;
+            Lane t4 = t3 ^ t2;
+            Lane t5 = y4 & x7;
+            Lane t6 = t5 ^ t2;
+            Lane t7 = y13 & y16;
+            Lane t8 = y5 & y1;
+            Lane t9 = t8 ^ t7;
+            Lane t10 = y2 & y7;
+            Lane t11 = t10 ^ t7;
+            Lane t12 = y9 & y11;
+            Lane t13 = y14 & y17;
+            Lane t14 = t13 ^ t12;
+            Lane t15 = y8 & y10;
+            Lane t16 = t15 ^ t12;
+            Lane t17 = t4 ^ t14;
+            Lane t18 = t6 ^ t16;
+            Lane t19 = t9 ^ t14;
+            Lane t20 = t11 ^ t16;
+            Lane t21 = t17 ^ y20;
+            Lane t22 = t18 ^ y19;
+            Lane t23 = t19 ^ y21;
+            Lane t24 = t20 ^ y18;
+
+            Lane t25 = t21 ^ t22;
+            Lane t26 = t21 & t23;
+            Lane t27 = t24 ^ t26;
+            Lane t28 = t25 & t27;
+            Lane t29 = t28 ^ t22;
+            Lane t30 = t23 ^ t24;
+            Lane t31 = t22 ^ t26;
+            Lane t32 = t31 & t30;
+            Lane t33 = t32 ^ t24;
+            Lane t34 = t23 ^ t33;
+            Lane t35 = t27 ^ t33;
+            Lane t36 = t24 & t35;
+            Lane t37 = t36 ^ t34;
+            Lane t38 = t27 ^ t36;
+            Lane t39 = t29 & t38;
+            Lane t40 = t25 ^ t39;
+
+            Lane t41 = t40 ^ t37;
+            Lane t42 = t29 ^ t33;
+            Lane t43 = t29 ^ t40;
+            Lane t44 = t33 ^ t37;
+            Lane t45 = t42 ^ t41;
+            Lane z0 = t44 & y15;
+            Lane z1 = t37 & y6;
+            Lane z2 = t33 & x7;
+            Lane z3 = t43 & y16;
+            Lane z4 = t40 & y1;
+            Lane z5 = t29 & y7;
+            Lane z6 = t42 & y11;
+            Lane z7 = t45 & y17;
+            Lane z8 = t41 & y10;
+            Lane z9 = t44 & y12;
+            Lane z10 = t37 & y3;
+            Lane z11 = t33 & y4;
+            Lane z12 = t43 & y13;
+            Lane z13 = t40 & y5;
+            Lane z14 = t29 & y2;
+            Lane z15 = t42 & y9;
+            Lane z16 = t45 & y14;
+            Lane z17 = t41 & y8;
+
+            // Bottom linear transformation.
+            Lane t46 = z15 ^ z16;
+            Lane t47 = z10 ^ z11;
+            Lane t48 = z5 ^ z13;
+            Lane t49 = z9 ^ z10;
+            Lane t50 = z2 ^ z12;
+            Lane t51 = z2 ^ z5;
+            Lane t52 = z7 ^ z8;
+            Lane t53 = z0 ^ z3;
+            Lane t54 = z6 ^ z7;
+            Lane t55 = z16 ^ z17;
+            Lane t56 = z12 ^ t48;
+            Lane t57 = t50 ^ t53;
+            Lane t58 = z4 ^ t46;
+            Lane t59 = z3 ^ t54;
+            Lane t60 = t46 ^ t57;
+            Lane t61 = z14 ^ t57;
+            Lane t62 = t52 ^ t58;
+            Lane t63 = t49 ^ t58;
+            Lane t64 = z4 ^ t59;
+            Lane t65 = t61 ^ t62;
+            Lane t66 = z1 ^ t63;
+            Lane s0 = t59 ^ t63;
+            Lane s6 = t56 ^ ~t62;
+            Lane s7 = t48 ^ ~t60;
+            Lane t67 = t64 ^ t65;
+            Lane s3 = t53 ^ t66;
+            Lane s4 = t51 ^ t66;
+            Lane s5 = t47 ^ t65;
+            Lane s1 = t64 ^ ~s3;
+            Lane s2 = t55 ^ ~t67;
+
+            q[7] = s0;
+            q[6] = s1;
+            q[5] = s2;
+            q[4] = s3;
+            q[3] = s4;
+            q[2] = s5;
+            q[1] = s6;
+            q[0] = s7;
+        }
+    };
+
+    void BatchTest();
+} // AESLib
+
+#endif //AESHASHMITM_BATCH_AES_H
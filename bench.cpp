@@ -0,0 +1,447 @@
+#include "aes.h"
+#include "aes_ni.h"
+#include "aes_simd.h"
+#include "counter_random.h"
+#include "gf.h"
+#include "log.h"
+#include "match_table.h"
+#include "mitm_4_round.h"
+#include "mitm_7_plus.h"
+#include "mitm_7_round.h"
+#include "parallel.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Every allocation of the process is counted, so that a benchmark can report
+// the bytes it allocates per operation.
+static std::atomic<std::uint64_t> allocated_bytes(0);
+static std::atomic<std::uint64_t> allocation_count(0);
+
+void *operator new(std::size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    auto alignment = (std::size_t) align;
+    if (void *p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    // Keep the compiler from dropping a result which nothing reads.
+    template<typename T>
+    inline void Keep(const T &x) {
+        asm volatile("" : : "g"(&x) : "memory");
+    }
+
+    struct Benchmark {
+        std::string name;
+        std::uint64_t ops;              // Operations one call of run does.
+        std::function<void()> run;
+    };
+
+    struct Measurement {
+        std::string name;
+        std::uint64_t ops = 0;
+        double seconds = 0;
+        std::uint64_t bytes = 0;
+        std::uint64_t allocations = 0;
+    };
+
+    // Call the benchmark once to warm up, then until min_time has passed.
+    Measurement Measure(const Benchmark &benchmark, double min_time) {
+        using namespace std::chrono;
+
+        benchmark.run();
+        Measurement measurement;
+        measurement.name = benchmark.name;
+        std::uint64_t bytes_before = allocated_bytes.load();
+        std::uint64_t allocations_before = allocation_count.load();
+        auto start = steady_clock::now();
+        do {
+            benchmark.run();
+            measurement.ops += benchmark.ops;
+            measurement.seconds = duration<double>(steady_clock::now() - start).count();
+        } while (measurement.seconds < min_time);
+        measurement.bytes = allocated_bytes.load() - bytes_before;
+        measurement.allocations = allocation_count.load() - allocations_before;
+        return measurement;
+    }
+
+    const char *BackendName(AESLib::Backend backend) {
+        return backend == AESLib::Backend::AESNI ? "aesni" : "portable";
+    }
+
+    const char *SIMDLevelName(AESLib::SIMDLevel level) {
+        switch (level) {
+            case AESLib::SIMDLevel::SSSE3:
+                return "ssse3";
+            case AESLib::SIMDLevel::AVX2:
+                return "avx2";
+            case AESLib::SIMDLevel::AVX512:
+                return "avx512";
+            default:
+                return "scalar";
+        }
+    }
+
+    const AESLib::Byte KEY[16] = {
+            0x2b, 0x7e, 0x15, 0x16,
+            0x28, 0xae, 0xd2, 0xa6,
+            0xab, 0xf7, 0x15, 0x88,
+            0x09, 0xcf, 0x4f, 0x3c,
+    };
+
+    const AESLib::Status PLAINTEXT = AESLib::Status(std::initializer_list<AESLib::Byte>(
+            {
+                    0x32, 0x88, 0x31, 0xe0,
+                    0x43, 0x5a, 0x31, 0x37,
+                    0xf6, 0x30, 0x98, 0x07,
+                    0xa8, 0x8d, 0xa2, 0x34,
+            }
+    ));
+
+    // The building blocks of AES. Each call chains the operations, so that
+    // the time is the latency of one operation.
+    void AddPrimitives(std::vector<Benchmark> &benchmarks) {
+        using namespace AESLib;
+        const int n = 1024;
+
+        benchmarks.push_back({"gf/mul", n, []() {
+            Byte x = 0x57;
+            for (int i = 0; i < n; i++) {
+                x = GFMul(x, (Byte) (i | 1)) ^ (Byte) i;
+            }
+            Keep(x);
+        }});
+        benchmarks.push_back({"status/sub_bytes", n, []() {
+            Status status = PLAINTEXT;
+            for (int i = 0; i < n; i++) {
+                status.SubBytes();
+            }
+            Keep(status);
+        }});
+        benchmarks.push_back({"status/mix_columns", n, []() {
+            Status status = PLAINTEXT;
+            for (int i = 0; i < n; i++) {
+                status.MixColumns();
+            }
+            Keep(status);
+        }});
+        benchmarks.push_back({"aes/key_expansion", n, []() {
+            AES aes(KEY, 4, 10);
+            Byte key[16];
+            for (int i = 0; i < 16; i++) {
+                key[i] = KEY[i];
+            }
+            for (int i = 0; i < n; i++) {
+                key[i & 15] ^= (Byte) i;
+                aes.KeyExpansion(key);
+            }
+            Keep(aes);
+        }});
+        benchmarks.push_back({"aes/round", n, []() {
+            static const AES aes(KEY, 4, 10);
+            Status status = PLAINTEXT;
+            for (int i = 0; i < n; i++) {
+                aes.Round(status, 1);
+            }
+            Keep(status);
+        }});
+        benchmarks.push_back({"aes/compression_function", n, []() {
+            static const AES aes(KEY, 4, 7);
+            Status status = PLAINTEXT;
+            for (int i = 0; i < n; i++) {
+                status = aes.CompressionFunction(status);
+            }
+            Keep(status);
+        }});
+
+        // The fast paths once per backend.
+        for (Backend backend: {Backend::Portable, Backend::AESNI}) {
+            if (backend == Backend::AESNI && not HasAESNI()) {
+                continue;
+            }
+            std::string suffix = std::string("/") + BackendName(backend);
+            benchmarks.push_back({"aes/round_fast" + suffix, n, [backend]() {
+                static const AES aes(KEY, 4, 10);
+                SetBackend(backend);
+                Status status = PLAINTEXT;
+                for (int i = 0; i < n; i++) {
+                    aes.RoundFast(status, 1);
+                }
+                Keep(status);
+            }});
+            benchmarks.push_back({"aes/compression_function_fast" + suffix, n, [backend]() {
+                static const AES aes(KEY, 4, 7);
+                SetBackend(backend);
+                Status status = PLAINTEXT;
+                for (int i = 0; i < n; i++) {
+                    status = aes.CompressionFunctionFast(status);
+                }
+                Keep(status);
+            }});
+            benchmarks.push_back({"aes/compression_column_fast" + suffix, n, [backend]() {
+                static const AES aes(KEY, 4, 7);
+                SetBackend(backend);
+                Status status = PLAINTEXT;
+                for (int i = 0; i < n; i++) {
+                    status.SetColumn(0, aes.CompressionColumnFast(status, 0));
+                }
+                Keep(status);
+            }});
+        }
+    }
+
+    // The phases of one MITM7Round structure, per neutral or candidate, and
+    // of MITM7Plus on a forward table cut down to 2^16 results.
+    void AddPhases(std::vector<Benchmark> &benchmarks, int thread_count) {
+        using namespace AESLib;
+
+        static const AES aes(KEY, 4, 7);
+        static const Status h_n = aes.CompressionFunction(PLAINTEXT);
+        static CounterRandom random(0xbe7c);
+        const int n = MITM7Round::Config::FORWARD_COUNT;
+
+        benchmarks.push_back({"mitm7/forward_chunk", n, []() {
+            static RandomStream stream = random.Stream(0);
+            static const MITM7Round::Structure structure(aes, h_n, stream);
+            Word match[n];
+            structure.ForwardChunk(match);
+            Keep(match);
+        }});
+        benchmarks.push_back({"mitm7/forward_table_build", n, []() {
+            static Word match[n];
+            static bool ready = false;
+            if (not ready) {
+                RandomStream stream = random.Stream(1);
+                MITM7Round::Structure(aes, h_n, stream).ForwardChunk(match);
+                ready = true;
+            }
+            MITM7Round::Attack::Table table;
+            table.Reserve(n);
+            for (int i = 0; i < n; i++) {
+                table.Insert({(Byte) i, match[i]});
+            }
+            table.Build();
+            Keep(table);
+        }});
+        benchmarks.push_back({"mitm7/backward_probe", n, []() {
+            static RandomStream stream = random.Stream(2);
+            static MITM7Round::Structure structure(aes, h_n, stream);
+            static MITM7Round::Attack::Table table;
+            if (table.Size() == 0) {
+                Word match[n];
+                structure.ForwardChunk(match);
+                for (int i = 0; i < n; i++) {
+                    table.Insert({(Byte) i, match[i]});
+                }
+                table.Build();
+            }
+            std::size_t candidates = 0;
+            for (int i = 0; i < n; i++) {
+                Word match = structure.BackwardChunk((Byte) i);
+                auto range = table.Bucket(match);
+                for (auto iter = range.first; iter != range.second; iter++) {
+                    candidates += iter->match == match;
+                }
+            }
+            Keep(candidates);
+        }});
+        benchmarks.push_back({"mitm7/verification", 1024, []() {
+            static RandomStream stream = random.Stream(3);
+            static MITM7Round::Structure structure(aes, h_n, stream);
+            int passed = 0;
+            for (int i = 0; i < 1024; i++) {
+                passed += structure.CheckPlaintext(structure.ComputePlaintext((Byte) i, (Byte) (i >> 2)));
+            }
+            Keep(passed);
+        }});
+
+        // Every benchmark sets up what it needs on first use, so that each
+        // one measures the same under --filter. The blocks and the probes
+        // take their round keys from the key cache, as in Compute.
+        const std::size_t block_count = 0x100;
+        static RandomStream plus_stream = random.Stream(4);
+        static MITM7Plus::Structure plus(h_n, plus_stream);
+        static bool key_cache_ready = false;
+        static BucketTable<MITM7Plus::ChunkResult, MITM7Plus::MatchKey> plus_table;
+        static auto build_key_cache = [thread_count]() {
+            if (not key_cache_ready) {
+                plus.BuildKeyCache(thread_count);
+                key_cache_ready = true;
+            }
+        };
+        static auto build_table = [thread_count, block_count]() {
+            plus_table.Clear();
+            plus_table.GenerateBlocks(block_count, 0x100, [](std::size_t block, MITM7Plus::ChunkResult *results) {
+                plus.ForwardBlock((Word) block, results);
+            }, thread_count);
+            plus_table.Build(thread_count);
+        };
+        benchmarks.push_back({"mitm7plus/inv_key_gen", 256, []() {
+            for (Word i = 0; i < 256; i++) {
+                AES key = plus.InvKeyGen(i * 0x0101);
+                Keep(key);
+            }
+        }});
+        benchmarks.push_back({"mitm7plus/key_cache", 0x10000, [thread_count]() {
+            plus.BuildKeyCache(thread_count);
+            key_cache_ready = true;
+        }});
+        benchmarks.push_back({"mitm7plus/forward_table_build", block_count * 0x100, []() {
+            build_key_cache();
+            build_table();
+        }});
+        benchmarks.push_back({"mitm7plus/backward_probe", 0x10000, []() {
+            build_key_cache();
+            if (plus_table.Size() == 0) {
+                build_table();
+            }
+            std::uint64_t candidates = 0;
+            for (Word j = 0; j < 0x10000; j++) {
+                Word match = plus.BackwardComputation(j);
+                auto range = plus_table.Bucket(match);
+                for (auto iter = range.first; iter != range.second; iter++) {
+                    candidates += iter->match == match;
+                }
+            }
+            Keep(candidates);
+        }});
+        benchmarks.push_back({"mitm7plus/verification", 1024, []() {
+            build_key_cache();
+            int passed = 0;
+            for (Word i = 0; i < 1024; i++) {
+                passed += plus.CheckNeutral(i * 0x10101, i * 0x3b);
+            }
+            Keep(passed);
+        }});
+    }
+
+    // Whole attacks small enough to finish: MITM4Round until it finds its
+    // plaintext, and one MITM7Round structure.
+    void AddAttacks(std::vector<Benchmark> &benchmarks) {
+        using namespace AESLib;
+
+        benchmarks.push_back({"mitm4/attack", 1, []() {
+            static const AES aes(KEY, 4, MITM4Round::Config::ROUNDS);
+            static const Status h_n = aes.CompressionFunction(PLAINTEXT);
+            static std::uint64_t seed = 0;
+            CounterRandom random(++seed);
+            for (std::uint64_t i = 0;; i++) {
+                RandomStream stream = random.Stream(i);
+                MITM4Round::Structure structure(aes, h_n, stream);
+                if (not(structure.Computation() == Status())) {
+                    break;
+                }
+            }
+        }});
+        benchmarks.push_back({"mitm7/structure", 1, []() {
+            static const AES aes(KEY, 4, MITM7Round::Config::ROUNDS);
+            static const Status h_n = aes.CompressionFunction(PLAINTEXT);
+            static CounterRandom random(0x57a7);
+            static std::uint64_t i = 0;
+            RandomStream stream = random.Stream(i++);
+            MITM7Round::Structure structure(aes, h_n, stream);
+            Status result = structure.Computation();
+            Keep(result);
+        }});
+    }
+}
+
+// Benchmarks of the AES primitives, of the phases of the attacks and of small
+// attacks from end to end, as JSON on stdout. "--filter TEXT" runs the
+// benchmarks whose name contains TEXT, and "--min-time S" runs each one for S
+// seconds at least, 0.5 by default.
+int main(int argc, char *argv[]) {
+    using namespace std;
+    using namespace AESLib;
+
+    string filter;
+    double min_time = 0.5;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            stringstream ss(argv[++i]);
+            ss >> min_time;
+            if (ss.fail() || not ss.eof() || min_time < 0) {
+                Log::Error("A minimum time is a number of seconds, not " + string(argv[i]));
+                return 1;
+            }
+        } else {
+            Log::Error("Unknown argument: " + arg);
+            cerr << "Usage: " << argv[0] << " [--filter TEXT] [--min-time S]" << endl;
+            return 1;
+        }
+    }
+
+    const int thread_count = DefaultThreadCount();
+    const Backend backend = GetBackend();
+    vector<Benchmark> benchmarks;
+    AddPrimitives(benchmarks);
+    AddPhases(benchmarks, thread_count);
+    AddAttacks(benchmarks);
+
+    stringstream ss;
+    ss << "{\n"
+       << "  \"backend\": \"" << BackendName(backend) << "\",\n"
+       << "  \"simd\": \"" << SIMDLevelName(GetSIMDLevel()) << "\",\n"
+       << "  \"threads\": " << thread_count << ",\n"
+       << "  \"benchmarks\": [";
+    bool first = true;
+    for (const Benchmark &benchmark: benchmarks) {
+        if (benchmark.name.find(filter) == string::npos) {
+            continue;
+        }
+        SetBackend(backend);
+        Measurement m = Measure(benchmark, min_time);
+        double ops = (double) m.ops;
+        ss << (first ? "\n" : ",\n")
+           << "    {\"name\": \"" << m.name << "\""
+           << ", \"ops\": " << m.ops
+           << ", \"ns_per_op\": " << m.seconds * 1e9 / ops
+           << ", \"ops_per_s\": " << ops / m.seconds
+           << ", \"bytes_allocated_per_op\": " << (double) m.bytes / ops
+           << ", \"allocations_per_op\": " << (double) m.allocations / ops << "}";
+        first = false;
+    }
+    SetBackend(backend);
+    ss << "\n  ]\n}\n";
+    cout << ss.str();
+    return 0;
+}
@@ -17,7 +17,7 @@ namespace Calculator {
             string a, b;
             cin >> a >> b;
             if (b == "-1") {
-                cout << hex << (int) GFInvSlow(Hex2Int(a));
+                cout << hex << (int) GFInv(Hex2Int(a));
             } else if (b == "+") {
                 cin >> b;
                 cout << hex << (int)(Hex2Int(a) ^ Hex2Int(b));
@@ -47,7 +47,7 @@ namespace Calculator {
             return {};
         }
         for (int i = 0; i < n; i++) {
-            unsigned int k = GFInvSlow(a[i][i]);
+            unsigned int k = GFInv(a[i][i]);
             for (int j = i; j < m; j++) {
                 a[i][j] = GFMul(a[i][j], k);
             }
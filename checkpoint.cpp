@@ -0,0 +1,363 @@
+#include "checkpoint.h"
+
+#include "log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+namespace Checkpoint {
+    static const char *const STATE_HEADER = "AESHashMITM state 1";
+
+    bool Save(const std::string &path, const State &state) {
+        using namespace std;
+
+        stringstream ss;
+        ss << STATE_HEADER << "\n"
+           << "search " << state.search << "\n"
+           << "seed " << state.seed << "\n"
+           << "shard " << state.shard.index << "/" << state.shard.count << "\n"
+           << "structure " << state.structure << "\n"
+           << "backward " << state.backward << "\n"
+           << "candidates " << state.candidates << "\n"
+           << "seconds " << state.seconds << "\n"
+           << "finished " << state.finished << "\n"
+           << "exhausted " << state.exhausted << "\n"
+           << "solution " << state.solution << "\n"
+           << "targets " << state.targets << "\n";
+        for (const auto &hit: state.hits) {
+            ss << "hit " << hit.first << " " << hit.second << "\n";
+        }
+        ss << "end\n";
+        string text = ss.str();
+
+        // Without the sync the rename could reach the disk before the data,
+        // and a crash would leave an empty state.
+        string temp_path = path + ".tmp";
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            Log::Error("Can't create " + temp_path + ": " + strerror(errno));
+            return false;
+        }
+        bool ok = write(fd, text.data(), text.size()) == (ssize_t) text.size();
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+        if (not ok) {
+            Log::Error("Can't write " + path + ": " + strerror(errno));
+            remove(temp_path.c_str());
+        }
+        return ok;
+    }
+
+    bool Load(const std::string &path, State &state) {
+        using namespace std;
+
+        ifstream file(path);
+        if (not file) {
+            Log::Error("Can't open " + path);
+            return false;
+        }
+        string line;
+        getline(file, line);
+        if (line != STATE_HEADER) {
+            Log::Error(path + " is not a state file of this version");
+            return false;
+        }
+        State loaded;
+        bool complete = false;
+        while (getline(file, line)) {
+            stringstream ss(line);
+            string name;
+            ss >> name;
+            if (name == "search") {
+                ss >> loaded.search;
+            } else if (name == "seed") {
+                ss >> loaded.seed;
+            } else if (name == "shard") {
+                string text;
+                ss >> text;
+                if (not ParseShard(text, loaded.shard)) {
+                    break;
+                }
+            } else if (name == "structure") {
+                ss >> loaded.structure;
+            } else if (name == "backward") {
+                ss >> loaded.backward;
+            } else if (name == "candidates") {
+                ss >> loaded.candidates;
+            } else if (name == "seconds") {
+                ss >> loaded.seconds;
+            } else if (name == "finished") {
+                ss >> loaded.finished;
+            } else if (name == "exhausted") {
+                ss >> loaded.exhausted;
+            } else if (name == "solution") {
+                // Empty when nothing was found.
+                ss >> loaded.solution;
+                ss.clear();
+            } else if (name == "targets") {
+                ss >> loaded.targets;
+            } else if (name == "hit") {
+                std::uint64_t target = 0;
+                string solution;
+                ss >> target >> solution;
+                loaded.hits[target] = solution;
+            } else if (name == "end") {
+                complete = true;
+                break;
+            }
+            if (ss.fail()) {
+                break;
+            }
+        }
+        if (not complete) {
+            Log::Error(path + " is truncated or broken");
+            return false;
+        }
+        state = loaded;
+        return true;
+    }
+
+    bool ParseShard(const std::string &text, Shard &shard) {
+        std::stringstream ss(text);
+        Shard parsed;
+        char slash = 0;
+        ss >> parsed.index >> slash >> parsed.count;
+        if (ss.fail() || not ss.eof() || slash != '/' || parsed.count == 0 || parsed.index >= parsed.count) {
+            Log::Error("A shard is k/N with k < N, not " + text);
+            return false;
+        }
+        shard = parsed;
+        return true;
+    }
+
+    static std::string ShardText(const Shard &shard) {
+        return std::to_string(shard.index) + "/" + std::to_string(shard.count);
+    }
+
+    bool Begin(const std::string &search, const Options &options, State &state) {
+        const std::string &path = options.state_path;
+        if (not options.resume) {
+            state = State();
+            state.search = search;
+            state.seed = options.seed != 0 ? options.seed : NewSeed();
+            state.shard = options.shard;
+            return true;
+        }
+        if (path.empty()) {
+            Log::Error("Resuming needs a state file");
+            return false;
+        }
+        if (not Load(path, state)) {
+            return false;
+        }
+        if (state.search != search) {
+            Log::Error(path + " is the state of " + state.search + ", not of " + search);
+            return false;
+        }
+        if (state.shard.index != options.shard.index || state.shard.count != options.shard.count) {
+            Log::Error(path + " is the state of shard " + ShardText(state.shard) +
+                       ", not of " + ShardText(options.shard));
+            return false;
+        }
+        return true;
+    }
+
+    bool Merge(const std::vector<State> &states, State &merged) {
+        if (states.empty()) {
+            Log::Error("There are no states to merge");
+            return false;
+        }
+        merged = State();
+        merged.search = states[0].search;
+        merged.seed = states[0].seed;
+        merged.exhausted = true;
+        std::set<std::uint64_t> shards;
+        for (const State &state: states) {
+            if (state.search != merged.search || state.seed != merged.seed || state.targets != states[0].targets ||
+                state.shard.count != states[0].shard.count) {
+                Log::Error("The states belong to different searches");
+                return false;
+            }
+            if (not shards.insert(state.shard.index).second) {
+                Log::Error("Shard " + ShardText(state.shard) + " appears twice");
+                return false;
+            }
+            merged.structure += state.structure;
+            merged.backward += state.backward;
+            merged.candidates += state.candidates;
+            merged.seconds += state.seconds;
+            if (state.finished && not merged.finished) {
+                merged.finished = true;
+                merged.solution = state.solution;
+            }
+            merged.exhausted = merged.exhausted && state.exhausted;
+            merged.targets = state.targets;
+            merged.hits.insert(state.hits.begin(), state.hits.end());
+        }
+        if (shards.size() != states[0].shard.count) {
+            merged.exhausted = false;
+            Log::Warning(std::to_string(shards.size()) + " of " + std::to_string(states[0].shard.count) +
+                         " shards have reported");
+        }
+        return true;
+    }
+
+    std::uint64_t NewSeed() {
+        std::random_device rd;
+        return (std::uint64_t) rd() << 32 | rd();
+    }
+
+    Checkpointer::Checkpointer(
+            std::string path_,
+            const State &state_,
+            std::uint64_t State::*cursor_,
+            std::chrono::seconds interval_
+    ) : path(std::move(path_)), interval(interval_), cursor(cursor_), state(state_) {
+        started = std::chrono::steady_clock::now();
+        last_save = started;
+        seconds_before = state.seconds;
+    }
+
+    Checkpointer::~Checkpointer() {
+        std::lock_guard<std::mutex> lock(mutex);
+        SaveLocked();
+    }
+
+    bool Checkpointer::SaveLocked() {
+        auto now = std::chrono::steady_clock::now();
+        last_save = now;
+        state.seconds = seconds_before + std::chrono::duration<double>(now - started).count();
+        return path.empty() || Save(path, state);
+    }
+
+    State Checkpointer::Current() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return state;
+    }
+
+    void Checkpointer::Done(std::uint64_t item, std::uint64_t candidates) {
+        std::lock_guard<std::mutex> lock(mutex);
+        state.candidates += candidates;
+        std::uint64_t &next = state.*cursor;
+        if (item == next) {
+            next++;
+            while (not done.empty() && *done.begin() == next) {
+                done.erase(done.begin());
+                next++;
+            }
+        } else if (item > next) {
+            done.insert(item);
+        }
+        if (std::chrono::steady_clock::now() - last_save >= interval) {
+            SaveLocked();
+        }
+    }
+
+    void Checkpointer::Finish(const std::string &solution) {
+        std::lock_guard<std::mutex> lock(mutex);
+        state.finished = true;
+        state.solution = solution;
+        SaveLocked();
+    }
+
+    void Checkpointer::Exhaust() {
+        std::lock_guard<std::mutex> lock(mutex);
+        state.exhausted = true;
+        SaveLocked();
+    }
+
+    bool Checkpointer::Hit(std::uint64_t target, const std::string &solution) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (not state.hits.emplace(target, solution).second) {
+            return false;
+        }
+        SaveLocked();
+        return true;
+    }
+
+    void Test() {
+        std::string path = "/tmp/aeshashmitm_state_test_" + std::to_string(getpid());
+        State state;
+        state.search = "test";
+        state.seed = 0x0123456789abcdef;
+        state.structure = 5;
+        {
+            // Items 5, 7 and 8 done leave the cursor at 6 until 6 is done.
+            Checkpointer checkpointer(path, state, &State::structure, std::chrono::seconds(0));
+            checkpointer.Done(7, 1);
+            checkpointer.Done(5, 2);
+            checkpointer.Done(8, 3);
+        }
+        State loaded;
+        bool flag = Load(path, loaded) && loaded.structure == 6 && loaded.candidates == 6 &&
+                    loaded.seed == state.seed && loaded.search == "test" && not loaded.finished;
+        {
+            // A resumed run redoes 7 and 8, which the state doesn't record.
+            Checkpointer checkpointer(path, loaded, &State::structure, std::chrono::seconds(0));
+            checkpointer.Done(6);
+            flag = flag && checkpointer.Hit(3, "0a0b") && not checkpointer.Hit(3, "0c0d");
+            checkpointer.Finish("00ff");
+        }
+        flag = flag && Load(path, loaded) && loaded.structure == 7 && loaded.finished && loaded.solution == "00ff" &&
+               loaded.hits.size() == 1 && loaded.hits[3] == "0a0b" && not loaded.exhausted;
+        {
+            // The end of a run saves its progress before the interval, and
+            // an exhausted shard is no finished one.
+            Checkpointer checkpointer(path, state, &State::backward, std::chrono::seconds(3600));
+            checkpointer.Done(0, 4);
+            checkpointer.Done(1);
+        }
+        flag = flag && Load(path, loaded) && loaded.backward == 2 && loaded.candidates == 4 && not loaded.exhausted;
+        {
+            Checkpointer checkpointer(path, loaded, &State::backward, std::chrono::seconds(3600));
+            checkpointer.Done(2);
+            checkpointer.Exhaust();
+        }
+        flag = flag && Load(path, loaded) && loaded.backward == 3 && loaded.exhausted && not loaded.finished;
+
+        // Shards 0 and 2 of 3, one with a solution.
+        State shard_0 = state, shard_2 = state, merged;
+        shard_0.shard = {0, 3};
+        shard_0.structure = 10;
+        shard_2.shard = {2, 3};
+        shard_2.structure = 20;
+        shard_2.finished = true;
+        shard_2.solution = "abcd";
+        shard_0.hits[1] = "01";
+        shard_2.hits[4] = "04";
+        Shard parsed;
+        flag = flag && Merge({shard_0, shard_2}, merged) && merged.structure == 30 &&
+               merged.finished && merged.solution == "abcd" && merged.hits.size() == 2 &&
+               not merged.exhausted && not Merge({shard_0, shard_0}, merged) &&
+               ParseShard("2/3", parsed) && parsed.index == 2 && parsed.count == 3 &&
+               not ParseShard("3/3", parsed) && not ParseShard("1/2x", parsed) &&
+               shard_2.GlobalIndex(4) == 14;
+
+        // The search is exhausted once all of its shards are.
+        State shard_1 = state;
+        shard_1.shard = {1, 3};
+        shard_0.exhausted = shard_1.exhausted = shard_2.exhausted = true;
+        flag = flag && Merge({shard_0, shard_2}, merged) && not merged.exhausted &&
+               Merge({shard_0, shard_1, shard_2}, merged) && merged.exhausted;
+
+        if (std::FILE *file = std::fopen(path.c_str(), "w")) {
+            std::fputs(STATE_HEADER, file);
+            std::fputs("\nseed 1\n", file);
+            std::fclose(file);
+        }
+        flag = flag && not Load(path, loaded);
+        std::remove(path.c_str());
+
+        if (flag) {
+            Log::Correct("Checkpoint test: passed");
+        } else {
+            Log::Error("Checkpoint test: failed");
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef AESHASHMITM_CHECKPOINT_H
+#define AESHASHMITM_CHECKPOINT_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Checkpoint {
+    // Process index of count sharing one search, "--shard index/count".
+    struct Shard {
+        std::uint64_t index = 0;
+        std::uint64_t count = 1;
+    };
+
+    // Parse "k/N" with k < N. Returns false and logs otherwise.
+    bool ParseShard(const std::string &text, Shard &shard);
+
+    // The first of n items which belong to a shard of count, as for
+    // AESLib::SliceBegin.
+    inline std::uint64_t ShardBegin(std::uint64_t n, std::uint64_t index, std::uint64_t count) {
+        return n * index / count;
+    }
+
+    // How a search runs. All shards of one search need the same seed.
+    struct Options {
+        std::string state_path;         // Empty for no checkpoints.
+        bool resume = false;
+        std::uint64_t seed = 0;         // 0 for a new random seed.
+        Shard shard;
+    };
+
+    // The progress of a long search, as the state file keeps it. The state
+    // file of a shard is also its result, see Merge.
+    struct State {
+        std::string search;             // The search which wrote the state.
+        std::uint64_t seed = 0;         // Structure i is drawn from seed and i only.
+        Shard shard;
+        std::uint64_t structure = 0;    // Every structure of this shard below is done.
+        std::uint64_t backward = 0;     // Every backward chunk of this shard below is done, for a single structure search.
+        std::uint64_t candidates = 0;   // Matches checked so far.
+        double seconds = 0;             // Time spent, over all runs.
+        bool finished = false;          // A solution was found, or every target was hit.
+        bool exhausted = false;         // Every item of this shard is done, without a solution.
+        std::string solution;           // What was found, in hex without spaces.
+        std::uint64_t targets = 0;      // A hash of the targets of a multi-target search.
+        std::map<std::uint64_t, std::string> hits;  // The solution of each target hit so far, by index.
+
+        // Structure local of this shard is structure GlobalIndex(local) of
+        // the whole search, the shards taking turns.
+        [[nodiscard]] std::uint64_t GlobalIndex(std::uint64_t local) const {
+            return local * shard.count + shard.index;
+        }
+    };
+
+    // Write state to path atomically: to a temporary file first, which is
+    // synced and then renamed over path. Returns false and logs on failure.
+    bool Save(const std::string &path, const State &state);
+
+    // Returns false and logs when path doesn't hold a valid state.
+    bool Load(const std::string &path, State &state);
+
+    // The state a search starts from: the one saved at the state path when
+    // resuming, which has to belong to the same search and shard, or a fresh
+    // one. Returns false and logs when the saved state can't be used.
+    bool Begin(const std::string &search, const Options &options, State &state);
+
+    // Merge the states of the shards of one search into the state of the
+    // whole: the counters add up, the time is the sum over the shards, and a
+    // solution of any shard is the solution, as is a hit of any shard. The
+    // search is exhausted once every shard is. Returns false and logs when the
+    // states belong to different searches or a shard repeats. Missing shards
+    // are logged only, so that a search can be watched while it runs.
+    bool Merge(const std::vector<State> &states, State &merged);
+
+    // A seed for a new search. Structure i of the search is drawn from stream
+    // i of an AESLib::CounterRandom with the seed.
+    std::uint64_t NewSeed();
+
+    // Tracks a cursor of State over work items which finish out of order,
+    // and saves the state every interval, and once more when it is destroyed
+    // at the end of the run. The cursor moves past an item once it and all
+    // the items before it are done, so a resumed search redoes at most the
+    // items which were running. An empty path saves nothing.
+    class Checkpointer {
+        std::string path;
+        std::chrono::seconds interval;
+        std::uint64_t State::*cursor;
+        std::mutex mutex;
+        State state;
+        std::set<std::uint64_t> done;   // Finished items above the cursor.
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point last_save;
+        double seconds_before;          // state.seconds when this run started.
+
+        bool SaveLocked();
+
+    public:
+        Checkpointer(
+                std::string path_,
+                const State &state_,
+                std::uint64_t State::*cursor_,
+                std::chrono::seconds interval_ = std::chrono::seconds(60)
+        );
+
+        Checkpointer(const Checkpointer &) = delete;
+
+        Checkpointer &operator=(const Checkpointer &) = delete;
+
+        ~Checkpointer();
+
+        [[nodiscard]] State Current();
+
+        // Item finished after checking candidates matches. Saves the state
+        // when the interval has passed since the last save.
+        void Done(std::uint64_t item, std::uint64_t candidates = 0);
+
+        // Mark the search as finished with solution and save the state now.
+        void Finish(const std::string &solution);
+
+        // Mark every item as done without a solution and save the state now,
+        // so that the state tells a finished shard from an interrupted one.
+        void Exhaust();
+
+        // Record the solution of target and save the state now. Returns false
+        // when the target was hit before, which keeps its first solution.
+        bool Hit(std::uint64_t target, const std::string &solution);
+    };
+
+    void Test();
+}
+
+#endif //AESHASHMITM_CHECKPOINT_H
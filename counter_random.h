@@ -0,0 +1,69 @@
+#ifndef AESHASHMITM_COUNTER_RANDOM_H
+#define AESHASHMITM_COUNTER_RANDOM_H
+
+#include "aes.h"
+#include <cstdint>
+
+namespace AESLib {
+    // One stream of a CounterRandom, a UniformRandomBitGenerator of 32 bit
+    // words. It refers to its CounterRandom, which has to outlive it.
+    class RandomStream {
+        const AES *aes;
+        std::uint64_t index;
+        std::uint64_t block = 0;    // The next counter block.
+        Status buffer;
+        int position = 4;           // The next column of buffer.
+
+    public:
+        typedef std::uint32_t result_type;
+
+        RandomStream(const AES &aes_, std::uint64_t index_) : aes(&aes_), index(index_) {
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return 0xffffffff;
+        }
+
+        result_type operator()() {
+            if (position == 4) {
+                buffer = aes->CipherFast(Status({
+                        (Word) (index >> 32), (Word) index,
+                        (Word) (block >> 32), (Word) block
+                }));
+                block++;
+                position = 0;
+            }
+            return buffer.Column(position++);
+        }
+    };
+
+    // AES-128 in counter mode as a generator of independent streams. The key
+    // is the seed, and stream i encrypts the blocks (i, 0), (i, 1), ..., so
+    // any stream is reached directly from (seed, i) with no state in between.
+    // Structure i of a search draws from stream i.
+    class CounterRandom {
+        AES aes;
+
+    public:
+        explicit CounterRandom(std::uint64_t seed);
+
+        [[nodiscard]] RandomStream Stream(std::uint64_t index) const & {
+            return {aes, index};
+        }
+
+        // A stream would outlive a temporary generator.
+        RandomStream Stream(std::uint64_t index) const && = delete;
+    };
+
+    // The next stream of a generator seeded once per process, for structures
+    // which needn't be reproduced. Safe to call from several threads.
+    RandomStream NextRandomStream();
+
+    void CounterRandomTest();
+} // AESLib
+
+#endif //AESHASHMITM_COUNTER_RANDOM_H
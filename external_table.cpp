@@ -0,0 +1,388 @@
+#include "external_table.h"
+
+#include "log.h"
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace AESLib {
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string &path) {
+        Close();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            Log::Error("Can't open " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        struct stat st = {};
+        if (fstat(fd, &st) != 0) {
+            Log::Error("Can't stat " + path + ": " + std::strerror(errno));
+            close(fd);
+            return false;
+        }
+        if (st.st_size > 0) {
+            void *p = mmap(nullptr, (std::size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                Log::Error("Can't map " + path + ": " + std::strerror(errno));
+                close(fd);
+                return false;
+            }
+            data = p;
+            size = (std::size_t) st.st_size;
+        }
+        // The mapping stays valid without the descriptor.
+        close(fd);
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data != nullptr) {
+            munmap(data, size);
+        }
+        data = nullptr;
+        size = 0;
+    }
+
+    static const char INDEX_MAGIC[8] = {'M', 'I', 'T', 'M', 'I', 'D', 'X', '\0'};
+    static const std::uint32_t INDEX_VERSION = 1;
+    static_assert(sizeof(IndexHeader) == 48, "Results after the header stay 16 byte aligned.");
+
+    std::uint64_t Hash64(const void *data, std::size_t size, std::uint64_t hash) {
+        const std::uint64_t PRIME = 0x100000001b3;
+        const auto *bytes = (const unsigned char *) data;
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            hash = (hash ^ word) * PRIME;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ bytes[i]) * PRIME;
+        }
+        return hash;
+    }
+
+    // Hash64 over the results one at a time, as MergeRuns writes them.
+    static std::uint64_t ResultsChecksum(const char *results, std::size_t count, std::size_t size) {
+        std::uint64_t hash = Hash64(nullptr, 0);
+        for (std::size_t i = 0; i < count; i++) {
+            hash = Hash64(results + i * size, size, hash);
+        }
+        return hash;
+    }
+
+    bool LoadIndex(MappedFile &file, const std::string &path, std::size_t result_size, std::uint64_t key) {
+        if (access(path.c_str(), F_OK) != 0 || not file.Open(path)) {
+            return false;
+        }
+        IndexHeader header = {};
+        if (file.Size() >= sizeof(header)) {
+            std::memcpy(&header, file.Data(), sizeof(header));
+        }
+        const char *results = (const char *) file.Data() + sizeof(header);
+        std::string problem;
+        if (file.Size() < sizeof(header) || std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+            problem = "not an index";
+        } else if (header.version != INDEX_VERSION || header.result_size != result_size) {
+            problem = "another version";
+        } else if (header.key != key) {
+            problem = "built for another structure";
+        } else if (file.Size() - sizeof(header) != header.count * result_size ||
+                   ResultsChecksum(results, header.count, result_size) != header.checksum) {
+            problem = "corrupted";
+        }
+        if (not problem.empty()) {
+            Log::Warning("Ignoring " + path + ": " + problem);
+            file.Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool WriteRun(const std::string &path, const void *data, std::size_t size, std::size_t n) {
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            Log::Error("Can't create " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        bool ok = std::fwrite(data, size, n, file) == n;
+        ok = std::fclose(file) == 0 && ok;
+        if (not ok) {
+            Log::Error("Can't write " + path);
+        }
+        return ok;
+    }
+
+    // Reads a run file a block of results at a time.
+    class RunReader {
+        std::FILE *file = nullptr;
+        std::vector<char> block;
+        std::size_t size;
+        std::size_t count = 0;      // Results in block.
+        std::size_t position = 0;   // The current result in block.
+
+    public:
+        static const std::size_t BLOCK_RESULTS = 1 << 14;
+
+        RunReader(std::FILE *file_, std::size_t size_) :
+                file(file_), block(size_ * BLOCK_RESULTS), size(size_) {
+        }
+
+        RunReader(const RunReader &) = delete;
+
+        RunReader &operator=(const RunReader &) = delete;
+
+        ~RunReader() {
+            std::fclose(file);
+        }
+
+        // Move to the next result, false at the end of the run.
+        bool Next() {
+            if (++position < count) {
+                return true;
+            }
+            count = std::fread(block.data(), size, BLOCK_RESULTS, file);
+            position = 0;
+            return count > 0;
+        }
+
+        [[nodiscard]] const char *Current() const {
+            return block.data() + position * size;
+        }
+    };
+
+    bool MergeRuns(
+            const std::vector<std::string> &runs,
+            const std::string &path,
+            std::size_t size,
+            std::size_t match_offset,
+            std::uint64_t key
+    ) {
+        using namespace std;
+
+        vector<unique_ptr<RunReader>> readers;
+        for (const string &run: runs) {
+            FILE *file = fopen(run.c_str(), "rb");
+            if (file == nullptr) {
+                Log::Error("Can't open " + run + ": " + strerror(errno));
+                return false;
+            }
+            readers.push_back(make_unique<RunReader>(file, size));
+        }
+        string temp_path = path + ".tmp";
+        FILE *out = fopen(temp_path.c_str(), "wb");
+        if (out == nullptr) {
+            Log::Error("Can't create " + temp_path + ": " + strerror(errno));
+            return false;
+        }
+        // The header is written again with the count and checksum at the end.
+        IndexHeader header = {};
+        memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        header.version = INDEX_VERSION;
+        header.result_size = (uint32_t) size;
+        header.key = key;
+        header.checksum = Hash64(nullptr, 0);
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+        auto match_of = [&](int run) {
+            Word match;
+            memcpy(&match, readers[run]->Current() + match_offset, sizeof(Word));
+            return match;
+        };
+        // The smallest match first, and the earliest run among equal matches.
+        typedef pair<Word, int> Head;
+        priority_queue<Head, vector<Head>, greater<>> heads;
+        for (int run = 0; run < (int) readers.size(); run++) {
+            // A fresh reader has no block yet, so Next() reads the first one.
+            if (readers[run]->Next()) {
+                heads.emplace(match_of(run), run);
+            }
+        }
+        while (not heads.empty() && ok) {
+            int run = heads.top().second;
+            heads.pop();
+            ok = fwrite(readers[run]->Current(), size, 1, out) == 1;
+            header.count++;
+            header.checksum = Hash64(readers[run]->Current(), size, header.checksum);
+            if (readers[run]->Next()) {
+                heads.emplace(match_of(run), run);
+            }
+        }
+        ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = fclose(out) == 0 && ok;
+        ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+        if (not ok) {
+            Log::Error("Can't write " + path);
+            remove(temp_path.c_str());
+            return false;
+        }
+        readers.clear();
+        for (const string &run: runs) {
+            remove(run.c_str());
+        }
+        return true;
+    }
+
+    struct ExternalTableEntry {
+        Word neutral;
+        Word match;
+    };
+
+    static bool ExternalTableTest(Word match_mask, int n, std::size_t run_size, int thread_count) {
+        // Every pair of equal matches has to be joined once, in run order for
+        // the results, as a multimap does it.
+        std::mt19937 mt(n);
+        std::string prefix = "/tmp/aeshashmitm_external_test_" + std::to_string(getpid());
+        ExternalTable<ExternalTableEntry> table(prefix, run_size);
+        std::multimap<Word, Word> expected;
+        std::vector<Word> matches;
+        for (int i = 0; i < n; i++) {
+            matches.push_back(mt() & match_mask);
+            expected.insert({matches[i], (Word) i});
+        }
+        bool ok;
+        if (thread_count == 1) {
+            ok = true;
+            for (int i = 0; i < n; i++) {
+                ok = table.Insert({(Word) i, matches[i]}) && ok;
+            }
+        } else {
+            ok = table.GenerateBlocks(n / 16, 16, [&](std::size_t block, ExternalTableEntry *results) {
+                for (int i = 0; i < 16; i++) {
+                    Word neutral = (Word) (block * 16 + i);
+                    results[i] = {neutral, matches[neutral]};
+                }
+            }, thread_count);
+        }
+        if (not ok || not table.Build() || table.Size() != (std::size_t) n) {
+            return false;
+        }
+
+        MatchTable<ExternalTableEntry> probes;
+        for (int i = 0; i < n; i++) {
+            probes.Insert({(Word) i, (Word) (mt() & match_mask)});
+        }
+        probes.Sort();
+        std::vector<std::pair<Word, Word>> joined;
+        table.Join(probes.Data(), probes.Size(), [&](const ExternalTableEntry &result, const ExternalTableEntry &probe) {
+            if (result.match != probe.match) {
+                joined.push_back({0xffffffff, 0xffffffff});
+            }
+            joined.push_back({probe.neutral, result.neutral});
+            return false;
+        });
+        std::vector<std::pair<Word, Word>> expected_joined;
+        for (std::size_t j = 0; j < probes.Size(); j++) {
+            auto range = expected.equal_range(probes.Data()[j].match);
+            for (auto iter = range.first; iter != range.second; iter++) {
+                expected_joined.push_back({probes.Data()[j].neutral, iter->second});
+            }
+        }
+
+        // Stopping early has to work as well.
+        std::size_t calls = 0;
+        bool stopped = table.Join(probes.Data(), probes.Size(), [&](const ExternalTableEntry &, const ExternalTableEntry &) {
+            return ++calls == 3;
+        });
+        return joined == expected_joined && stopped == (expected_joined.size() >= 3) &&
+               calls == (expected_joined.size() >= 3 ? 3 : expected_joined.size());
+    }
+
+    static bool ExternalIndexTest() {
+        // A kept index has to load with its key only, and not once a byte of
+        // it changed.
+        std::string prefix = "/tmp/aeshashmitm_external_index_test_" + std::to_string(getpid());
+        std::mt19937 mt(1);
+        std::vector<ExternalTableEntry> built;
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            for (int i = 0; i < 5000; i++) {
+                table.Insert({(Word) i, (Word) mt()});
+            }
+            if (not table.Build(0x1234)) {
+                return false;
+            }
+            built.assign(table.Data(), table.Data() + table.Size());
+            table.Keep();
+        }
+        bool flag;
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            flag = table.Load(0x1234) && table.Size() == built.size();
+            for (std::size_t i = 0; flag && i < built.size(); i++) {
+                flag = table.Data()[i].neutral == built[i].neutral && table.Data()[i].match == built[i].match;
+            }
+        }
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            flag = flag && not table.Load(0x4321);
+        }
+        std::string path = prefix + ".index";
+        if (std::FILE *file = std::fopen(path.c_str(), "r+b")) {
+            std::fseek(file, sizeof(IndexHeader) + 100, SEEK_SET);
+            int byte = std::fgetc(file);
+            std::fseek(file, sizeof(IndexHeader) + 100, SEEK_SET);
+            std::fputc(byte ^ 1, file);
+            std::fclose(file);
+        }
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            flag = flag && not table.Load(0x1234);
+        }
+        std::remove(path.c_str());
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            flag = flag && not table.Load(0x1234);
+        }
+        return flag;
+    }
+
+    static bool ExternalBuildErrorTest() {
+        // A build which can't write the index leaves no runs behind. A
+        // directory in the way of the temporary index makes it fail.
+        std::string prefix = "/tmp/aeshashmitm_external_error_test_" + std::to_string(getpid());
+        std::string temp_path = prefix + ".index.tmp";
+        if (mkdir(temp_path.c_str(), 0700) != 0) {
+            return false;
+        }
+        bool flag;
+        {
+            ExternalTable<ExternalTableEntry> table(prefix, 1000);
+            for (int i = 0; i < 5000; i++) {
+                table.Insert({(Word) i, (Word) i});
+            }
+            flag = not table.Build() && access((prefix + ".run.0").c_str(), F_OK) == 0;
+        }
+        for (int i = 0; i < 5; i++) {
+            flag = flag && access((prefix + ".run." + std::to_string(i)).c_str(), F_OK) != 0;
+        }
+        flag = flag && access((prefix + ".index").c_str(), F_OK) != 0;
+        rmdir(temp_path.c_str());
+        return flag;
+    }
+
+    void ExternalTableTest() {
+        if (ExternalTableTest(0xffffffff, 1 << 14, 1000, 1) &&
+            ExternalTableTest(0x00000fff, 1 << 14, 1000, 1) &&
+            ExternalTableTest(0x0000ff0f, 1 << 14, 4096, 3) &&
+            ExternalTableTest(0xffffffff, 1 << 10, 1 << 20, 1) &&
+            ExternalTableTest(0xffffffff, 0, 100, 1) &&
+            ExternalIndexTest() &&
+            ExternalBuildErrorTest()) {
+            Log::Correct("External table test: passed");
+        } else {
+            Log::Error("External table test: failed");
+        }
+    }
+} // AESLib
@@ -0,0 +1,254 @@
+#ifndef AESHASHMITM_EXTERNAL_TABLE_H
+#define AESHASHMITM_EXTERNAL_TABLE_H
+
+#include "aes.h"
+#include "match_table.h"
+#include "parallel.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace AESLib {
+    // A whole file mapped read-only. An empty file maps to no data.
+    class MappedFile {
+        void *data = nullptr;
+        std::size_t size = 0;
+
+    public:
+        MappedFile() = default;
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile();
+
+        // Map the file at path, dropping the previous mapping. Returns false
+        // and logs the reason when the file can't be mapped.
+        bool Open(const std::string &path);
+
+        void Close();
+
+        [[nodiscard]] const void *Data() const {
+            return data;
+        }
+
+        [[nodiscard]] std::size_t Size() const {
+            return size;
+        }
+    };
+
+    // 64 bit FNV-1a style hash, 8 bytes at a time with the tail byte-wise.
+    std::uint64_t Hash64(const void *data, std::size_t size, std::uint64_t hash = 0xcbf29ce484222325);
+
+    // The index file of an ExternalTable starts with this header, followed by
+    // count results sorted by match.
+    struct IndexHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t result_size;
+        std::uint64_t key;          // Hash of everything the results depend on.
+        std::uint64_t count;
+        std::uint64_t checksum;     // Hash64 chained over the results in order.
+        std::uint64_t reserved;
+    };
+
+    // Map the index at path if it exists and its header matches result_size
+    // and key, with a valid checksum. A missing file is not an error, a stale
+    // or broken one is logged.
+    bool LoadIndex(MappedFile &file, const std::string &path, std::size_t result_size, std::uint64_t key);
+
+    // Write n results to path as raw bytes. Returns false and logs the reason
+    // on failure.
+    bool WriteRun(const std::string &path, const void *data, std::size_t size, std::size_t n);
+
+    // Merge the sorted run files into the index at path, with key in its
+    // header. Results of equal matches keep the order of the runs, and the
+    // runs are removed afterwards. The index is written under a temporary name
+    // and renamed, so path never holds a partial index.
+    bool MergeRuns(
+            const std::vector<std::string> &runs,
+            const std::string &path,
+            std::size_t size,
+            std::size_t match_offset,
+            std::uint64_t key
+    );
+
+    // Forward results of a MITM chunk which need not fit in memory. Results
+    // are collected run_size at a time, sorted and written to a run file;
+    // Build() merges the runs into one index file sorted by match and maps it
+    // read-only. Load() maps the index a previous table left on disk instead,
+    // when it was built with the same key. Join() walks the index forward
+    // only, against backward results sorted the same way, so the I/O stays
+    // sequential. Result is the ChunkResult of an attack, as for MatchTable.
+    template<typename Result>
+    class ExternalTable {
+        static_assert(std::is_trivially_copyable<Result>::value, "Results are written to files as raw bytes.");
+
+        std::string prefix;     // Runs are prefix.run.<i>, the index is prefix.index.
+        std::size_t run_size;
+        MatchTable<Result> buffer;
+        std::vector<std::string> runs;
+        MappedFile index;
+        bool ok = true;         // No write has failed so far.
+        bool owns_index = false;    // Build() wrote the index and Keep() wasn't called.
+
+        bool Flush() {
+            if (buffer.Size() == 0) {
+                return ok;
+            }
+            buffer.Sort();
+            std::string path = prefix + ".run." + std::to_string(runs.size());
+            runs.push_back(path);
+            ok = ok && WriteRun(path, buffer.Data(), sizeof(Result), buffer.Size());
+            buffer.Clear();
+            return ok;
+        }
+
+        // The first position from begin on whose match is not below match.
+        // It gallops, so probes close together cost little.
+        [[nodiscard]] std::size_t Seek(std::size_t begin, Word match) const {
+            const Result *results = Data();
+            std::size_t n = Size();
+            std::size_t step = 1;
+            std::size_t end = begin;
+            while (end < n && results[end].match < match) {
+                begin = end + 1;
+                end += step;
+                step <<= 1;
+            }
+            if (end > n) {
+                end = n;
+            }
+            while (begin < end) {
+                std::size_t middle = begin + (end - begin) / 2;
+                if (results[middle].match < match) {
+                    begin = middle + 1;
+                } else {
+                    end = middle;
+                }
+            }
+            return begin;
+        }
+
+    public:
+        ExternalTable(std::string prefix_, std::size_t run_size_) :
+                prefix(std::move(prefix_)), run_size(run_size_ == 0 ? 1 : run_size_) {
+        }
+
+        ExternalTable(const ExternalTable &) = delete;
+
+        ExternalTable &operator=(const ExternalTable &) = delete;
+
+        ~ExternalTable() {
+            index.Close();
+            for (const std::string &run: runs) {
+                std::remove(run.c_str());
+            }
+            if (owns_index) {
+                std::remove((prefix + ".index").c_str());
+            }
+        }
+
+        // Map the index at prefix.index if a table with the same key built
+        // it. A loaded index is never removed.
+        bool Load(std::uint64_t key) {
+            return LoadIndex(index, prefix + ".index", sizeof(Result), key);
+        }
+
+        // Leave the built index on disk when the table is destroyed.
+        void Keep() {
+            owns_index = false;
+        }
+
+        // Returns false once writing a run has failed.
+        bool Insert(const Result &result) {
+            buffer.Insert(result);
+            return buffer.Size() < run_size || Flush();
+        }
+
+        // Insert block_count blocks of block_size results, where f(block,
+        // results) writes the results of one block. As many blocks as fit in
+        // a run are generated at once on thread_count workers.
+        template<typename F>
+        bool GenerateBlocks(std::size_t block_count, std::size_t block_size, F f, int thread_count) {
+            std::size_t run_blocks = run_size / block_size == 0 ? 1 : run_size / block_size;
+            for (std::size_t first = 0; first < block_count && ok; first += run_blocks) {
+                std::size_t count = block_count - first < run_blocks ? block_count - first : run_blocks;
+                std::size_t base = buffer.Size();
+                buffer.Resize(base + count * block_size);
+                Result *results = buffer.Data() + base;
+                ParallelFor(thread_count, [&](int t) {
+                    std::size_t end = SliceBegin(count, t + 1, thread_count);
+                    for (std::size_t block = SliceBegin(count, t, thread_count); block < end; block++) {
+                        f(first + block, results + block * block_size);
+                    }
+                });
+                if (buffer.Size() >= run_size) {
+                    Flush();
+                }
+            }
+            return ok;
+        }
+
+        // Merge the runs into the index and map it. No results can be
+        // inserted afterwards. key identifies the results for Load().
+        bool Build(std::uint64_t key = 0) {
+            if (not Flush()) {
+                return false;
+            }
+            std::string path = prefix + ".index";
+            ok = MergeRuns(runs, path, sizeof(Result), offsetof(Result, match), key);
+            if (not ok) {
+                // MergeRuns removes the runs only when it succeeds, so the
+                // destructor removes them otherwise.
+                return false;
+            }
+            runs.clear();
+            owns_index = true;
+            return index.Open(path);
+        }
+
+        [[nodiscard]] std::size_t Size() const {
+            return index.Size() < sizeof(IndexHeader) ? 0 : (index.Size() - sizeof(IndexHeader)) / sizeof(Result);
+        }
+
+        [[nodiscard]] const Result *Data() const {
+            return (const Result *) ((const char *) index.Data() + sizeof(IndexHeader));
+        }
+
+        // Call f(result, probe) for every result and probe with equal matches,
+        // until f returns true. The n probes have to be sorted by match, the
+        // table must be built. Returns whether f stopped the join.
+        template<typename Probe, typename F>
+        bool Join(const Probe *probes, std::size_t n, F f) const {
+            const Result *results = Data();
+            std::size_t size = Size();
+            std::size_t position = 0;
+            for (std::size_t j = 0; j < n;) {
+                Word match = probes[j].match;
+                position = Seek(position, match);
+                std::size_t end = position;
+                while (end < size && results[end].match == match) {
+                    end++;
+                }
+                for (; j < n && probes[j].match == match; j++) {
+                    for (std::size_t i = position; i < end; i++) {
+                        if (f(results[i], probes[j])) {
+                            return true;
+                        }
+                    }
+                }
+                position = end;
+            }
+            return false;
+        }
+    };
+
+    void ExternalTableTest();
+} // AESLib
+
+#endif //AESHASHMITM_EXTERNAL_TABLE_H
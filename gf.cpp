@@ -0,0 +1,41 @@
+#include "gf.h"
+
+#include "log.h"
+
+namespace AESLib {
+    static_assert(GF_EXP[0] == 0x01 && GF_EXP[1] == 0x03 && GF_EXP[255] == 0x01);
+    static_assert(GF_LOG[0x03] == 1);
+    static_assert(GF_MUL[0x57][0x83] == 0xc1);  // FIPS 197 section 4.2.
+    static_assert(GF_MUL[0x57][0x13] == 0xfe);  // FIPS 197 section 4.2.1.
+    static_assert(GFMulBy(0x02)(0x80) == 0x1b);
+    static_assert(GF_INV[0x00] == 0x00 && GF_INV[0x01] == 0x01);
+    static_assert(GF_INV[0x53] == 0xca);  // FIPS 197 section 5.1.1.
+
+    void GFTest() {
+        bool mul_flag = true;
+        for (int x = 0; x < 0x100; x++) {
+            for (int y = 0; y < 0x100; y++) {
+                if (GFMul(x, y) != GFMulSlow(x, y)) {
+                    mul_flag = false;
+                }
+            }
+        }
+        if (mul_flag) {
+            Log::Correct("GFMul table test: passed");
+        } else {
+            Log::Error("GFMul table test: failed");
+        }
+
+        bool inv_flag = true;
+        for (int x = 0; x < 0x100; x++) {
+            if (GFInv(x) != GFInvSlow(x)) {
+                inv_flag = false;
+            }
+        }
+        if (inv_flag) {
+            Log::Correct("GFInv table test: passed");
+        } else {
+            Log::Error("GFInv table test: failed");
+        }
+    }
+} // AESLib
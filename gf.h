@@ -0,0 +1,112 @@
+#ifndef AESHASHMITM_GF_H
+#define AESHASHMITM_GF_H
+
+#include <array>
+
+namespace AESLib {
+    typedef unsigned char Byte;
+
+    typedef std::array<Byte, 256> GFRow;
+
+    constexpr Byte GFMulSlow(Byte x, Byte y) {
+        // Multiplication in GF(2^8) for AESLib modulo x^8+x^4+x^3+x+1.
+        Byte ret = 0;
+        for (; x; x >>= 1) {
+            if (x & 1)
+                ret ^= y;
+            if (y & 0x80) {
+                y = (Byte) (y << 1 ^ 0x1b);
+            } else {
+                y = (Byte) (y << 1);
+            }
+        }
+        return ret;
+    }
+
+    constexpr std::array<Byte, 512> MakeGFExpTable() {
+        // 0x03 generates the multiplicative group. The table is doubled so that
+        // log(x) + log(y) can be used as index without reduction modulo 255.
+        std::array<Byte, 512> ret = {};
+        Byte x = 1;
+        for (int i = 0; i < 255; i++) {
+            ret[i] = x;
+            ret[i + 255] = x;
+            x = GFMulSlow(x, 0x03);
+        }
+        ret[510] = ret[0];
+        ret[511] = ret[1];
+        return ret;
+    }
+
+    inline constexpr std::array<Byte, 512> GF_EXP = MakeGFExpTable();
+
+    constexpr GFRow MakeGFLogTable() {
+        // log(0) is undefined and left as 0, callers have to check zero first.
+        GFRow ret = {};
+        for (int i = 0; i < 255; i++) {
+            ret[GF_EXP[i]] = (Byte) i;
+        }
+        return ret;
+    }
+
+    inline constexpr GFRow GF_LOG = MakeGFLogTable();
+
+    constexpr std::array<GFRow, 256> MakeGFMulTable() {
+        std::array<GFRow, 256> ret = {};
+        for (int x = 1; x < 256; x++) {
+            for (int y = 1; y < 256; y++) {
+                ret[x][y] = GF_EXP[GF_LOG[x] + GF_LOG[y]];
+            }
+        }
+        return ret;
+    }
+
+    // GF_MUL[x][y] = x * y. Row x is the 256 entries table of "multiply by x".
+    inline constexpr std::array<GFRow, 256> GF_MUL = MakeGFMulTable();
+
+    inline Byte GFMul(Byte x, Byte y) {
+        return GF_MUL[x][y];
+    }
+
+    constexpr Byte GFInvSlow(Byte x) {
+        // Brute force, only used to check GF_INV.
+        for (int i = 1; i < 0x100; i++) {
+            if (GFMulSlow((Byte) i, x) == 1) {
+                return (Byte) i;
+            }
+        }
+        return 0;
+    }
+
+    constexpr GFRow MakeGFInvTable() {
+        // 0 has no inverse and is mapped to 0, as the S-box requires.
+        GFRow ret = {};
+        for (int x = 1; x < 256; x++) {
+            ret[x] = GF_EXP[255 - GF_LOG[x]];
+        }
+        return ret;
+    }
+
+    inline constexpr GFRow GF_INV = MakeGFInvTable();
+
+    inline Byte GFInv(Byte x) {
+        return GF_INV[x];
+    }
+
+    // Multiplication by a fixed constant. It binds the row of GF_MUL once, so
+    // the constant tables in the match functions can be declared as GFMulBy
+    // instead of Byte and then be called like functions.
+    class GFMulBy {
+        const Byte *row;
+    public:
+        constexpr GFMulBy(Byte c) : row(GF_MUL[c].data()) {} // NOLINT: implicit on purpose.
+
+        constexpr Byte operator()(Byte x) const {
+            return row[x];
+        }
+    };
+
+    void GFTest();
+} // AESLib
+
+#endif //AESHASHMITM_GF_H
@@ -7,9 +7,10 @@ namespace Log {
     void PrintTime() {
         using namespace std;
         auto time1 = time(nullptr);
-        auto time2 = localtime(&time1);
+        tm time2 = {};
+        localtime_r(&time1, &time2);
         char time_str[32];
-        strftime(time_str, 32, "%Y-%m-%d %H:%M:%S", time2);
+        strftime(time_str, 32, "%Y-%m-%d %H:%M:%S", &time2);
         cout << time_str << " ";
     }
 
@@ -0,0 +1,127 @@
+#include "match_table.h"
+
+#include "log.h"
+#include <map>
+#include <random>
+#include <vector>
+
+namespace AESLib {
+    struct MatchTableEntry {
+        Word neutral;
+        Word match;
+    };
+
+    static bool MatchTableTest(Word match_mask, int n) {
+        // Compare against a multimap on random matches, including many
+        // duplicates when the mask is narrow.
+        std::mt19937 mt(n);
+        MatchTable<MatchTableEntry> table;
+        std::multimap<Word, Word> expected;
+        for (int i = 0; i < n; i++) {
+            Word match = mt() & match_mask;
+            table.Insert({(Word) i, match});
+            expected.insert({match, (Word) i});
+        }
+        table.Sort();
+        for (int i = 0; i < n; i++) {
+            Word match = mt() & match_mask;
+            auto range = table.Find(match);
+            auto expected_range = expected.equal_range(match);
+            // The sort is stable and the multimap keeps insertion order.
+            auto iter = range.first;
+            auto expected_iter = expected_range.first;
+            for (; iter != range.second && expected_iter != expected_range.second; iter++, expected_iter++) {
+                if (iter->match != match || iter->neutral != expected_iter->second) {
+                    return false;
+                }
+            }
+            if (iter != range.second || expected_iter != expected_range.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<int BITS>
+    struct PrefixKey {
+        static const int KEY_BITS = BITS;
+
+        static Word Of(Word match) {
+            return match >> (32 - BITS);
+        }
+    };
+
+    template<int BITS>
+    static bool BucketTableTest(Word match_mask, int n, int thread_count) {
+        // Every result with the match has to be in its bucket, in insertion
+        // order, and the rest of the bucket has other matches of the same key.
+        std::mt19937 mt(n);
+        BucketTable<MatchTableEntry, PrefixKey<BITS>> table;
+        std::multimap<Word, Word> expected;
+        std::vector<Word> matches;
+        for (int i = 0; i < n; i++) {
+            Word match = mt() & match_mask;
+            matches.push_back(match);
+            expected.insert({match, (Word) i});
+        }
+        if (thread_count == 1) {
+            for (int i = 0; i < n; i++) {
+                table.Insert({(Word) i, matches[i]});
+            }
+            table.Build();
+        } else {
+            table.Generate(n, [&](std::size_t i) -> MatchTableEntry {
+                return {(Word) i, matches[i]};
+            }, thread_count);
+            table.Build(thread_count);
+        }
+        for (int i = 0; i < n; i++) {
+            Word match = mt() & match_mask;
+            auto range = table.Bucket(match);
+            auto expected_range = expected.equal_range(match);
+            auto expected_iter = expected_range.first;
+            for (auto iter = range.first; iter != range.second; iter++) {
+                if (PrefixKey<BITS>::Of(iter->match) != PrefixKey<BITS>::Of(match)) {
+                    return false;
+                }
+                if (iter->match != match) {
+                    continue;
+                }
+                if (expected_iter == expected_range.second || iter->neutral != expected_iter->second) {
+                    return false;
+                }
+                expected_iter++;
+            }
+            if (expected_iter != expected_range.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void MatchTableTest() {
+        if (MatchTableTest(0xffffffff, 1 << 16) &&
+            MatchTableTest(0x0000ffff, 1 << 16) &&
+            MatchTableTest(0x00ff00ff, 1 << 12) &&
+            MatchTableTest(0xffffffff, 0)) {
+            Log::Correct("Match table test: passed");
+        } else {
+            Log::Error("Match table test: failed");
+        }
+
+        bool bucket_flag = true;
+        for (int thread_count: {1, 3, 8}) {
+            bucket_flag = bucket_flag &&
+                          BucketTableTest<8>(0xffffffff, 1 << 12, thread_count) &&
+                          BucketTableTest<16>(0xffff00ff, 1 << 16, thread_count) &&
+                          BucketTableTest<8>(0xffffffff, 0, thread_count) &&
+                          BucketTableTest<4>(0xffffffff, 5, thread_count) &&
+                          BucketTableTest<24>(0xfff0000f, 1 << 16, thread_count);
+        }
+        if (bucket_flag) {
+            Log::Correct("Bucket table test: passed");
+        } else {
+            Log::Error("Bucket table test: failed");
+        }
+    }
+} // AESLib
@@ -0,0 +1,251 @@
+#ifndef AESHASHMITM_MATCH_TABLE_H
+#define AESHASHMITM_MATCH_TABLE_H
+
+#include "aes.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace AESLib {
+    // The forward results of a MITM chunk, in one flat array. Results are
+    // appended first, then Sort() orders them by their Word match with an LSD
+    // radix sort, and Find() returns the results sharing a match. Result is
+    // the ChunkResult of an attack and needs a public Word member "match".
+    template<typename Result>
+    class MatchTable {
+        std::vector<Result> results;
+
+        struct Compare {
+            bool operator()(const Result &x, Word y) const {
+                return x.match < y;
+            }
+
+            bool operator()(Word x, const Result &y) const {
+                return x < y.match;
+            }
+        };
+
+    public:
+        typedef typename std::vector<Result>::const_iterator Iterator;
+
+        void Reserve(std::size_t n) {
+            results.reserve(n);
+        }
+
+        void Clear() {
+            results.clear();
+        }
+
+        void Insert(const Result &result) {
+            results.push_back(result);
+        }
+
+        [[nodiscard]] std::size_t Size() const {
+            return results.size();
+        }
+
+        // Grow or shrink to n results, so that they can be written in place
+        // through Data().
+        void Resize(std::size_t n) {
+            results.resize(n);
+        }
+
+        [[nodiscard]] Result *Data() {
+            return results.data();
+        }
+
+        [[nodiscard]] const Result *Data() const {
+            return results.data();
+        }
+
+        // Stable, 8 bits per pass. A pass is skipped when every match has the
+        // same digit there, so 16 bit matches only pay for two passes.
+        void Sort() {
+            const std::size_t n = results.size();
+            std::vector<Result> buffer(results);
+            for (int shift = 0; shift < 32; shift += 8) {
+                std::size_t count[0x100] = {};
+                for (const Result &result: results) {
+                    count[result.match >> shift & 0xff]++;
+                }
+                if (count[results.empty() ? 0 : results[0].match >> shift & 0xff] == n) {
+                    continue;
+                }
+                std::size_t offset = 0;
+                for (auto &c: count) {
+                    std::size_t temp = c;
+                    c = offset;
+                    offset += temp;
+                }
+                for (const Result &result: results) {
+                    buffer[count[result.match >> shift & 0xff]++] = result;
+                }
+                results.swap(buffer);
+            }
+        }
+
+        // All results whose match is the given one. The table must be sorted.
+        [[nodiscard]] std::pair<Iterator, Iterator> Find(Word match) const {
+            return std::equal_range(
+                    results.begin(), results.end(), match,
+                    Compare()
+            );
+        }
+    };
+
+    // Forward results grouped by a key of their match with a counting sort, so
+    // that the bucket of a backward match is found with one offset lookup.
+    // Key has a static KEY_BITS and a static Word Of(Word match) below
+    // 2^KEY_BITS. When Key drops bits of the match, a bucket can hold other
+    // matches as well and the caller has to compare them.
+    template<typename Result, typename Key>
+    class BucketTable {
+        std::vector<Result> results;
+        std::vector<std::uint32_t> offset;  // Bucket k is results[offset[k], offset[k + 1]).
+
+        // A single counting sort, when the buckets are few enough to stay in
+        // the cache.
+        void BuildSmall() {
+            offset.assign(((std::size_t) 1 << Key::KEY_BITS) + 1, 0);
+            for (const Result &result: results) {
+                offset[Key::Of(result.match) + 1]++;
+            }
+            for (std::size_t k = 1; k < offset.size(); k++) {
+                offset[k] += offset[k - 1];
+            }
+            std::vector<Result> buffer(results);
+            std::vector<std::uint32_t> next(offset.begin(), offset.end() - 1);
+            for (const Result &result: results) {
+                buffer[next[Key::Of(result.match)]++] = result;
+            }
+            results.swap(buffer);
+        }
+
+    public:
+        typedef typename std::vector<Result>::const_iterator Iterator;
+
+        void Reserve(std::size_t n) {
+            results.reserve(n);
+        }
+
+        void Clear() {
+            results.clear();
+            offset.clear();
+        }
+
+        void Insert(const Result &result) {
+            results.push_back(result);
+        }
+
+        [[nodiscard]] std::size_t Size() const {
+            return results.size();
+        }
+
+        // Fill the table with f(0), ..., f(n - 1). Every worker writes its own
+        // contiguous slice, so Result has to be default constructible.
+        template<typename F>
+        void Generate(std::size_t n, F f, int thread_count) {
+            results.resize(n);
+            ParallelFor(thread_count, [&](int t) {
+                std::size_t end = SliceBegin(n, t + 1, thread_count);
+                for (std::size_t i = SliceBegin(n, t, thread_count); i < end; i++) {
+                    results[i] = f(i);
+                }
+            });
+        }
+
+        // Fill the table with block_count blocks of block_size results, where
+        // f(block, results) writes the results of one block.
+        template<typename F>
+        void GenerateBlocks(std::size_t block_count, std::size_t block_size, F f, int thread_count) {
+            results.resize(block_count * block_size);
+            ParallelFor(thread_count, [&](int t) {
+                std::size_t end = SliceBegin(block_count, t + 1, thread_count);
+                for (std::size_t block = SliceBegin(block_count, t, thread_count); block < end; block++) {
+                    f(block, results.data() + block * block_size);
+                }
+            });
+        }
+
+        // Sort the results into their buckets on thread_count workers. It is
+        // stable, so a bucket keeps the insertion order. The workers first
+        // scatter their slices into partitions by the high 8 bits of the key,
+        // then each partition is counting sorted on the rest of the key alone.
+        // Even on one thread this two-level sort beats a single counting sort
+        // over 2^24 buckets, whose scattered writes miss the cache every time.
+        void Build(int thread_count = 1) {
+            if (thread_count <= 1 && Key::KEY_BITS <= 8) {
+                BuildSmall();
+                return;
+            }
+            const int PART_BITS = Key::KEY_BITS < 8 ? Key::KEY_BITS : 8;
+            const int LOW_BITS = Key::KEY_BITS - PART_BITS;
+            const std::size_t part_count = (std::size_t) 1 << PART_BITS;
+            const Word low_mask = ((Word) 1 << LOW_BITS) - 1;
+            const std::size_t n = results.size();
+
+            // next[t][p] is where worker t puts its next result of partition p.
+            std::vector<std::vector<std::size_t>> next(thread_count, std::vector<std::size_t>(part_count));
+            ParallelFor(thread_count, [&](int t) {
+                std::size_t end = SliceBegin(n, t + 1, thread_count);
+                for (std::size_t i = SliceBegin(n, t, thread_count); i < end; i++) {
+                    next[t][Key::Of(results[i].match) >> LOW_BITS]++;
+                }
+            });
+            std::vector<std::size_t> part_begin(part_count + 1);
+            std::size_t position = 0;
+            for (std::size_t p = 0; p < part_count; p++) {
+                part_begin[p] = position;
+                for (int t = 0; t < thread_count; t++) {
+                    std::size_t temp = next[t][p];
+                    next[t][p] = position;
+                    position += temp;
+                }
+            }
+            part_begin[part_count] = n;
+
+            std::vector<Result> buffer(n);
+            ParallelFor(thread_count, [&](int t) {
+                std::size_t end = SliceBegin(n, t + 1, thread_count);
+                for (std::size_t i = SliceBegin(n, t, thread_count); i < end; i++) {
+                    buffer[next[t][Key::Of(results[i].match) >> LOW_BITS]++] = results[i];
+                }
+            });
+
+            offset.resize(((std::size_t) 1 << Key::KEY_BITS) + 1);
+            ParallelFor(thread_count, [&](int t) {
+                std::vector<std::size_t> count((std::size_t) 1 << LOW_BITS);
+                for (std::size_t p = t; p < part_count; p += thread_count) {
+                    std::fill(count.begin(), count.end(), 0);
+                    for (std::size_t i = part_begin[p]; i < part_begin[p + 1]; i++) {
+                        count[Key::Of(buffer[i].match) & low_mask]++;
+                    }
+                    std::size_t bucket_begin = part_begin[p];
+                    for (std::size_t k = 0; k < count.size(); k++) {
+                        offset[p << LOW_BITS | k] = (std::uint32_t) bucket_begin;
+                        std::size_t temp = count[k];
+                        count[k] = bucket_begin;
+                        bucket_begin += temp;
+                    }
+                    for (std::size_t i = part_begin[p]; i < part_begin[p + 1]; i++) {
+                        results[count[Key::Of(buffer[i].match) & low_mask]++] = buffer[i];
+                    }
+                }
+            });
+            offset.back() = (std::uint32_t) n;
+        }
+
+        // The results in the bucket of match. The table must be built.
+        [[nodiscard]] std::pair<Iterator, Iterator> Bucket(Word match) const {
+            Word k = Key::Of(match);
+            return {results.begin() + offset[k], results.begin() + offset[k + 1]};
+        }
+    };
+
+    void MatchTableTest();
+} // AESLib
+
+#endif //AESHASHMITM_MATCH_TABLE_H
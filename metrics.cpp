@@ -0,0 +1,392 @@
+#include "metrics.h"
+
+#include "log.h"
+#include "parallel.h"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace Metrics {
+    static const char *const COUNTER_NAMES[COUNTER_COUNT] = {
+            "structures",
+            "forward_evaluations",
+            "backward_evaluations",
+            "table_probes",
+            "pairs",
+            "verifications",
+            "false_positives",
+    };
+
+    static const char *const COUNTER_HELP[COUNTER_COUNT] = {
+            "Structures joined.",
+            "Forward chunk results computed.",
+            "Backward chunk results computed.",
+            "Lookups of a match in a chunk table.",
+            "Forward and backward pairs the probes covered.",
+            "Equal matches, checked against the digest.",
+            "Verifications which failed.",
+    };
+
+    static const char *const PHASE_NAMES[PHASE_COUNT] = {
+            "setup",
+            "forward",
+            "backward",
+    };
+
+    const char *Name(Counter counter) {
+        return COUNTER_NAMES[(int) counter];
+    }
+
+    const char *Name(Phase phase) {
+        return PHASE_NAMES[(int) phase];
+    }
+
+    // What one thread has counted. Threads past SLOT_COUNT share slots,
+    // which the atomic additions keep correct.
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> counts[COUNTER_COUNT];
+        std::atomic<std::uint64_t> bucket_sizes[BUCKET_BINS];
+        std::atomic<std::uint64_t> bucket_size_sum;
+        std::atomic<std::uint64_t> phase_nanoseconds[PHASE_COUNT];
+        std::atomic<std::uint64_t> phase_calls[PHASE_COUNT];
+    };
+
+    static const int SLOT_COUNT = 256;
+    static Slot slots[SLOT_COUNT];
+    static std::atomic<int> next_slot(0);
+
+    // The clock of the snapshots and the worker threads of the search, as
+    // the last Reset set them.
+    static std::mutex start_mutex;
+    static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    static int worker_threads = 1;
+
+    static Slot &ThisSlot() {
+        thread_local Slot &slot = slots[next_slot++ % SLOT_COUNT];
+        return slot;
+    }
+
+    void Tally::Flush() {
+        Slot &slot = ThisSlot();
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            if (counts[i] != 0) {
+                slot.counts[i].fetch_add(counts[i], std::memory_order_relaxed);
+                counts[i] = 0;
+            }
+        }
+        for (int i = 0; i < BUCKET_BINS; i++) {
+            if (bucket_sizes[i] != 0) {
+                slot.bucket_sizes[i].fetch_add(bucket_sizes[i], std::memory_order_relaxed);
+                bucket_sizes[i] = 0;
+            }
+        }
+        if (bucket_size_sum != 0) {
+            slot.bucket_size_sum.fetch_add(bucket_size_sum, std::memory_order_relaxed);
+            bucket_size_sum = 0;
+        }
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        using namespace std::chrono;
+        auto nanoseconds = duration_cast<std::chrono::nanoseconds>(steady_clock::now() - start).count();
+        Slot &slot = ThisSlot();
+        slot.phase_nanoseconds[(int) phase].fetch_add((std::uint64_t) nanoseconds, std::memory_order_relaxed);
+        slot.phase_calls[(int) phase].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    double Snapshot::EvaluationsPerCoreSecond() const {
+        if (seconds <= 0) {
+            return 0;
+        }
+        double evaluations = (double) (Count(Counter::ForwardEvaluations) + Count(Counter::BackwardEvaluations));
+        return evaluations / seconds / threads;
+    }
+
+    double Snapshot::MatchRate() const {
+        std::uint64_t pairs = Count(Counter::Pairs);
+        return pairs == 0 ? 0 : (double) Count(Counter::Verifications) / (double) pairs;
+    }
+
+    double Snapshot::FalsePositiveRate() const {
+        std::uint64_t verifications = Count(Counter::Verifications);
+        return verifications == 0 ? 0 : (double) Count(Counter::FalsePositives) / (double) verifications;
+    }
+
+    // The largest bucket size of bin, as a Prometheus "le" bound.
+    static std::string BinBound(int bin) {
+        if (bin == BUCKET_BINS - 1) {
+            return "+Inf";
+        }
+        return std::to_string(((std::uint64_t) 1 << bin) - 1);
+    }
+
+    std::string Snapshot::ToJSON() const {
+        using namespace std;
+
+        stringstream ss;
+        ss << "{\n"
+           << "  \"seconds\": " << seconds << ",\n"
+           << "  \"threads\": " << threads << ",\n"
+           << "  \"counters\": {\n";
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            ss << "    \"" << COUNTER_NAMES[i] << "\": " << counts[i] << (i + 1 < COUNTER_COUNT ? ",\n" : "\n");
+        }
+        ss << "  },\n"
+           << "  \"bucket_sizes\": [\n";
+        for (int i = 0; i < BUCKET_BINS; i++) {
+            ss << "    {\"le\": \"" << BinBound(i) << "\", \"count\": " << bucket_sizes[i] << "}"
+               << (i + 1 < BUCKET_BINS ? ",\n" : "\n");
+        }
+        ss << "  ],\n"
+           << "  \"bucket_size_sum\": " << bucket_size_sum << ",\n"
+           << "  \"phases\": {\n";
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            ss << "    \"" << PHASE_NAMES[i] << "\": {\"seconds\": " << (double) phase_nanoseconds[i] * 1e-9
+               << ", \"calls\": " << phase_calls[i] << "}" << (i + 1 < PHASE_COUNT ? ",\n" : "\n");
+        }
+        double match_rate = MatchRate();
+        ss << "  },\n"
+           << "  \"rates\": {\n"
+           << "    \"structures_per_second\": "
+           << (seconds > 0 ? (double) Count(Counter::Structures) / seconds : 0) << ",\n"
+           << "    \"evaluations_per_core_second\": " << EvaluationsPerCoreSecond() << ",\n"
+           << "    \"match_rate\": " << match_rate << ",\n"
+           << "    \"match_rate_log2\": ";
+        if (match_rate > 0) {
+            ss << log2(match_rate);
+        } else {
+            ss << "null";
+        }
+        ss << ",\n"
+           << "    \"false_positive_rate\": " << FalsePositiveRate() << "\n"
+           << "  }\n"
+           << "}\n";
+        return ss.str();
+    }
+
+    std::string Snapshot::ToPrometheus() const {
+        using namespace std;
+
+        const string prefix = "aeshashmitm_";
+        stringstream ss;
+        ss << "# HELP " << prefix << "elapsed_seconds Time since the metrics were reset.\n"
+           << "# TYPE " << prefix << "elapsed_seconds gauge\n"
+           << prefix << "elapsed_seconds " << seconds << "\n"
+           << "# HELP " << prefix << "threads Worker threads of the search.\n"
+           << "# TYPE " << prefix << "threads gauge\n"
+           << prefix << "threads " << threads << "\n";
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            string name = prefix + COUNTER_NAMES[i] + "_total";
+            ss << "# HELP " << name << " " << COUNTER_HELP[i] << "\n"
+               << "# TYPE " << name << " counter\n"
+               << name << " " << counts[i] << "\n";
+        }
+
+        string name = prefix + "bucket_size";
+        ss << "# HELP " << name << " Entries of the buckets which the probes hit.\n"
+           << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < BUCKET_BINS; i++) {
+            cumulative += bucket_sizes[i];
+            ss << name << "_bucket{le=\"" << BinBound(i) << "\"} " << cumulative << "\n";
+        }
+        ss << name << "_sum " << bucket_size_sum << "\n"
+           << name << "_count " << cumulative << "\n";
+
+        ss << "# HELP " << prefix << "phase_seconds_total Time spent in each phase, over all threads.\n"
+           << "# TYPE " << prefix << "phase_seconds_total counter\n";
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            ss << prefix << "phase_seconds_total{phase=\"" << PHASE_NAMES[i] << "\"} "
+               << (double) phase_nanoseconds[i] * 1e-9 << "\n";
+        }
+        ss << "# HELP " << prefix << "phase_calls_total Times each phase ran.\n"
+           << "# TYPE " << prefix << "phase_calls_total counter\n";
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            ss << prefix << "phase_calls_total{phase=\"" << PHASE_NAMES[i] << "\"} " << phase_calls[i] << "\n";
+        }
+
+        ss << "# HELP " << prefix << "evaluations_per_core_second Chunk evaluations per second and thread.\n"
+           << "# TYPE " << prefix << "evaluations_per_core_second gauge\n"
+           << prefix << "evaluations_per_core_second " << EvaluationsPerCoreSecond() << "\n"
+           << "# HELP " << prefix << "match_rate Verifications per pair.\n"
+           << "# TYPE " << prefix << "match_rate gauge\n"
+           << prefix << "match_rate " << MatchRate() << "\n"
+           << "# HELP " << prefix << "false_positive_rate Failed verifications per verification.\n"
+           << "# TYPE " << prefix << "false_positive_rate gauge\n"
+           << prefix << "false_positive_rate " << FalsePositiveRate() << "\n";
+        return ss.str();
+    }
+
+    void Reset(int threads) {
+        for (Slot &slot: slots) {
+            for (auto &x: slot.counts) {
+                x.store(0, std::memory_order_relaxed);
+            }
+            for (auto &x: slot.bucket_sizes) {
+                x.store(0, std::memory_order_relaxed);
+            }
+            slot.bucket_size_sum.store(0, std::memory_order_relaxed);
+            for (int i = 0; i < PHASE_COUNT; i++) {
+                slot.phase_nanoseconds[i].store(0, std::memory_order_relaxed);
+                slot.phase_calls[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        std::lock_guard<std::mutex> lock(start_mutex);
+        start = std::chrono::steady_clock::now();
+        worker_threads = threads;
+    }
+
+    Snapshot Collect() {
+        using namespace std::chrono;
+
+        Snapshot snapshot;
+        {
+            std::lock_guard<std::mutex> lock(start_mutex);
+            snapshot.seconds = duration<double>(steady_clock::now() - start).count();
+            snapshot.threads = worker_threads;
+        }
+        for (const Slot &slot: slots) {
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                snapshot.counts[i] += slot.counts[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < BUCKET_BINS; i++) {
+                snapshot.bucket_sizes[i] += slot.bucket_sizes[i].load(std::memory_order_relaxed);
+            }
+            snapshot.bucket_size_sum += slot.bucket_size_sum.load(std::memory_order_relaxed);
+            for (int i = 0; i < PHASE_COUNT; i++) {
+                snapshot.phase_nanoseconds[i] += slot.phase_nanoseconds[i].load(std::memory_order_relaxed);
+                snapshot.phase_calls[i] += slot.phase_calls[i].load(std::memory_order_relaxed);
+            }
+        }
+        return snapshot;
+    }
+
+    static bool EndsWith(const std::string &text, const std::string &suffix) {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    bool Write(const std::string &path, const Snapshot &snapshot) {
+        // A reader of the file never sees half a snapshot.
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::trunc);
+            file << (EndsWith(path, ".prom") ? snapshot.ToPrometheus() : snapshot.ToJSON());
+            if (not file.flush()) {
+                Log::Error("Can't write " + temp_path);
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+            Log::Error("Can't write " + path);
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    Reporter::Reporter(std::string path_, int threads, std::chrono::seconds interval_)
+            : path(std::move(path_)), interval(interval_) {
+        if (path.empty()) {
+            return;
+        }
+        Reset(threads);
+        thread = std::thread(&Reporter::Loop, this);
+    }
+
+    void Reporter::Loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (not stop_signal.wait_for(lock, interval, [this]() { return stopping; })) {
+            lock.unlock();
+            Write(path, Collect());
+            lock.lock();
+        }
+    }
+
+    Reporter::~Reporter() {
+        if (not thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stop_signal.notify_one();
+        thread.join();
+        Write(path, Collect());
+    }
+
+    void Test() {
+        using namespace std;
+
+        // Tallies of several threads add up, whichever slots they take.
+        Snapshot before = Collect();
+        const int thread_count = 4;
+        AESLib::ParallelFor(thread_count, [](int t) {
+            ScopedTimer timer(Phase::Forward);
+            Tally tally;
+            tally.Add(Counter::ForwardEvaluations, 100);
+            tally.Add(Counter::Verifications, (uint64_t) t);
+            for (size_t size: {0, 1, 2, 3, 4, 100}) {
+                tally.Probe(size);
+            }
+        });
+        Snapshot after = Collect();
+        uint64_t bins[BUCKET_BINS] = {1, 1, 2, 1, 0, 0, 0, 1};
+        bool flag = after.Count(Counter::ForwardEvaluations) - before.Count(Counter::ForwardEvaluations) ==
+                    100 * thread_count &&
+                    after.Count(Counter::Verifications) - before.Count(Counter::Verifications) == 6 &&
+                    after.Count(Counter::TableProbes) - before.Count(Counter::TableProbes) == 6 * thread_count &&
+                    after.bucket_size_sum - before.bucket_size_sum == 110 * thread_count &&
+                    after.phase_calls[(int) Phase::Forward] - before.phase_calls[(int) Phase::Forward] ==
+                    thread_count;
+        for (int i = 0; i < BUCKET_BINS; i++) {
+            flag = flag && after.bucket_sizes[i] - before.bucket_sizes[i] == bins[i] * thread_count;
+        }
+
+        // Both formats carry the counters, and the last bucket of the
+        // histogram counts every probe.
+        Snapshot snapshot;
+        snapshot.seconds = 2;
+        snapshot.threads = 2;
+        snapshot.counts[(int) Counter::BackwardEvaluations] = 400;
+        snapshot.counts[(int) Counter::Pairs] = 1 << 20;
+        snapshot.counts[(int) Counter::Verifications] = 16;
+        snapshot.counts[(int) Counter::FalsePositives] = 4;
+        snapshot.bucket_sizes[1] = 3;
+        snapshot.bucket_sizes[BUCKET_BINS - 1] = 2;
+        string json = snapshot.ToJSON();
+        string prometheus = snapshot.ToPrometheus();
+        flag = flag && snapshot.EvaluationsPerCoreSecond() == 100 &&
+               snapshot.MatchRate() == 1.0 / (1 << 16) &&
+               snapshot.FalsePositiveRate() == 0.25 &&
+               json.find("\"backward_evaluations\": 400,") != string::npos &&
+               json.find("\"match_rate_log2\": -16,") != string::npos &&
+               prometheus.find("aeshashmitm_backward_evaluations_total 400\n") != string::npos &&
+               prometheus.find("aeshashmitm_bucket_size_bucket{le=\"+Inf\"} 5\n") != string::npos &&
+               prometheus.find("aeshashmitm_bucket_size_count 5\n") != string::npos;
+
+        // A reporter leaves its last snapshot at its path.
+        const string path = "/tmp/aeshashmitm_metrics_test_" + to_string(getpid()) + ".prom";
+        {
+            Reporter reporter(path, 3, chrono::seconds(3600));
+            Tally tally;
+            tally.Add(Counter::Structures, 3);
+        }
+        ifstream file(path);
+        stringstream text;
+        text << file.rdbuf();
+        flag = flag && text.str().find("aeshashmitm_structures_total 3\n") != string::npos &&
+               text.str().find("aeshashmitm_threads 3\n") != string::npos;
+        remove(path.c_str());
+
+        if (flag) {
+            Log::Correct("Metrics test: passed");
+        } else {
+            Log::Error("Metrics test: failed");
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef AESHASHMITM_METRICS_H
+#define AESHASHMITM_METRICS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Counters and phase timers of the searches, for the throughput and the
+// filtering of the matches. Every thread adds into its own slot, on its own
+// cache line, and a snapshot sums the slots. The hot loops count into a
+// Tally on the stack, which reaches the slot once per structure or chunk.
+namespace Metrics {
+    enum class Counter {
+        Structures,             // Structures joined.
+        ForwardEvaluations,     // Forward chunk results computed.
+        BackwardEvaluations,    // Backward chunk results computed.
+        TableProbes,            // Lookups of a match in a chunk table.
+        Pairs,                  // Forward and backward pairs the probes covered.
+        Verifications,          // Equal matches, checked against the digest.
+        FalsePositives,         // Verifications which failed.
+    };
+
+    const int COUNTER_COUNT = 7;
+
+    // Bin 0 counts the empty buckets a probe hit, bin k > 0 the buckets of
+    // 2^(k - 1) to 2^k - 1 entries, and the last bin everything bigger.
+    const int BUCKET_BINS = 8;
+
+    enum class Phase {
+        Setup,      // The structure and its key schedules.
+        Forward,    // The forward chunk, with the probes when it runs second.
+        Backward,   // The backward chunk, with the probes when it runs second.
+    };
+
+    const int PHASE_COUNT = 3;
+
+    [[nodiscard]] const char *Name(Counter counter);
+
+    [[nodiscard]] const char *Name(Phase phase);
+
+    // Counters of one thread, added to its slot when the tally goes out of
+    // scope, so that an early return counts as well.
+    class Tally {
+        std::uint64_t counts[COUNTER_COUNT] = {};
+        std::uint64_t bucket_sizes[BUCKET_BINS] = {};
+        std::uint64_t bucket_size_sum = 0;
+    public:
+        Tally() = default;
+
+        Tally(const Tally &) = delete;
+
+        Tally &operator=(const Tally &) = delete;
+
+        ~Tally() {
+            Flush();
+        }
+
+        void Add(Counter counter, std::uint64_t n = 1) {
+            counts[(int) counter] += n;
+        }
+
+        [[nodiscard]] std::uint64_t Count(Counter counter) const {
+            return counts[(int) counter];
+        }
+
+        // A probe which found a bucket of size entries.
+        void Probe(std::size_t size) {
+            counts[(int) Counter::TableProbes]++;
+            bucket_size_sum += size;
+            int bin = size == 0 ? 0 : 64 - __builtin_clzll(size);
+            bucket_sizes[bin < BUCKET_BINS ? bin : BUCKET_BINS - 1]++;
+        }
+
+        // Add the counts to the slot of this thread and start again from 0.
+        void Flush();
+    };
+
+    // Adds the time from its construction to its destruction to phase.
+    class ScopedTimer {
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+    public:
+        explicit ScopedTimer(Phase phase_) : phase(phase_), start(std::chrono::steady_clock::now()) {}
+
+        ScopedTimer(const ScopedTimer &) = delete;
+
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        ~ScopedTimer();
+    };
+
+    // The sums over all threads since the last Reset.
+    struct Snapshot {
+        double seconds = 0;
+        int threads = 1;                            // Worker threads, for the rates per core.
+        std::uint64_t counts[COUNTER_COUNT] = {};
+        std::uint64_t bucket_sizes[BUCKET_BINS] = {};
+        std::uint64_t bucket_size_sum = 0;
+        std::uint64_t phase_nanoseconds[PHASE_COUNT] = {};
+        std::uint64_t phase_calls[PHASE_COUNT] = {};
+
+        [[nodiscard]] std::uint64_t Count(Counter counter) const {
+            return counts[(int) counter];
+        }
+
+        // Forward and backward evaluations per second and worker thread.
+        [[nodiscard]] double EvaluationsPerCoreSecond() const;
+
+        // Verifications per pair: 2^-32 for a 32-bit match which behaves
+        // like a random one.
+        [[nodiscard]] double MatchRate() const;
+
+        // Failed verifications per verification.
+        [[nodiscard]] double FalsePositiveRate() const;
+
+        [[nodiscard]] std::string ToJSON() const;
+
+        // The Prometheus text format, for a node exporter's textfile
+        // collector.
+        [[nodiscard]] std::string ToPrometheus() const;
+    };
+
+    // Zero every slot and restart the clock of the snapshots, which count
+    // threads worker threads from now on. Only while no thread counts.
+    void Reset(int threads);
+
+    [[nodiscard]] Snapshot Collect();
+
+    // Write a snapshot to path atomically, in the Prometheus format when the
+    // path ends in ".prom" and in JSON otherwise. Returns false and logs on
+    // failure.
+    bool Write(const std::string &path, const Snapshot &snapshot);
+
+    // Resets the metrics for a search on threads worker threads, then writes
+    // a snapshot to path every interval on a thread of its own and a last one
+    // when it is destroyed. An empty path writes nothing.
+    class Reporter {
+        std::string path;
+        std::chrono::seconds interval;
+        std::mutex mutex;
+        std::condition_variable stop_signal;
+        bool stopping = false;
+        std::thread thread;
+
+        void Loop();
+
+    public:
+        Reporter(std::string path_, int threads, std::chrono::seconds interval_ = std::chrono::seconds(10));
+
+        Reporter(const Reporter &) = delete;
+
+        Reporter &operator=(const Reporter &) = delete;
+
+        ~Reporter();
+    };
+
+    void Test();
+}
+
+#endif //AESHASHMITM_METRICS_H
@@ -1,21 +1,14 @@
 #include "mitm_4_round.h"
 
 #include "aes.h"
+#include "checkpoint.h"
 #include "log.h"
-#include <random>
-#include <set>
+#include <cstdio>
 #include <sstream>
+#include <string>
+#include <unistd.h>
 
 namespace MITM4Round {
-    ChunkResult::ChunkResult(AESLib::Byte neutral_, AESLib::Byte b10, AESLib::Byte b32) {
-        neutral = neutral_;
-        match = (AESLib::Word) b10 << 8 | b32;
-    }
-
-    bool ChunkResult::operator<(ChunkResult y) const {
-        return match < y.match;
-    }
-
     Structure::Structure(AESLib::AES aes_, AESLib::Status h_n_) {
         aes = aes_;
         h_n = h_n_;
@@ -28,23 +21,32 @@ namespace MITM4Round {
         start = start_;
     }
 
+    Structure::Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::RandomStream &random) {
+        aes = aes_;
+        h_n = h_n_;
+        StartInit(random);
+    }
+
     void Structure::StartInit() {
+        AESLib::RandomStream random = AESLib::NextRandomStream();
+        StartInit(random);
+    }
+
+    void Structure::StartInit(AESLib::RandomStream &random) {
         using namespace AESLib;
         using namespace std;
 
-        random_device rd;
-        mt19937 mt(rd());
         start = Status(initializer_list<Word>{
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt())
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random())
         });
     }
 
     AESLib::Status Structure::ComputePlaintext(AESLib::Status status) const {
         aes.AddRoundKey(status, 2);
-        aes.Round(status, 3);
+        aes.RoundFast(status, 3);
         status.SubBytes();
         status.ShiftRows();
         aes.AddRoundKey(status, 4);
@@ -55,7 +57,7 @@ namespace MITM4Round {
     AESLib::Status Structure::ForwardComputation(AESLib::Status status) const {
         status = ComputePlaintext(status);
         aes.AddRoundKey(status, 0);
-        aes.Round(status, 1);
+        aes.RoundFast(status, 1);
         return status;
     }
 
@@ -66,49 +68,38 @@ namespace MITM4Round {
         return status;
     }
 
-    inline bool Structure::CheckPlaintext(AESLib::Status status) {
-        return PartialMatch(aes.CompressionFunction(status), h_n);
-        // return aes.CompressionFunction(status) == h_n;
+    // The same as PartialMatch(aes.CompressionFunctionFast(status), h_n),
+    // which compares the first byte only, without the rest of the last round.
+    bool Structure::CheckPlaintext(AESLib::Status status) {
+        return aes.CompressionColumnFast(status, 0) >> 24 == h_n.Column(0) >> 24;
     }
 
-    AESLib::Status Structure::Computation() {
+    // The chunks work on start in place, as the backward neutral stays in it
+    // from one call to the next.
+    void Structure::ForwardChunk(AESLib::Word *match) {
         using namespace AESLib;
-        using namespace std;
-
-        multiset<ChunkResult> forward_results{};
-        Status temp;
-        for (int i = 0; i < 0xff; i++) {
+        for (int i = 0; i < Config::FORWARD_COUNT; i++) {
             start.value[0][0] = (Byte) i;
-            temp = ForwardComputation(start);
-            forward_results.insert(ChunkResult(
-                    {
-                            (Byte) i,
-                            temp.value[1][0],
-                            temp.value[3][2]
-                    }
-            ));
+            Status temp = ForwardComputation(start);
+            match[i] = (Word) temp.value[1][0] << 8 | temp.value[3][2];
         }
+    }
 
-        for (int i = 0; i < 0xff; i++) {
-            start.value[0][3] = (Byte) i;
-            temp = BackwardComputation(start);
-            ChunkResult backward_result = {
-                    (Byte) i,
-                    temp.value[1][0],
-                    temp.value[3][2]
-            };
-            auto iter = forward_results.lower_bound(backward_result);
-            for (; iter != forward_results.end() &&
-                   iter->match == backward_result.match; iter++) {
-                start.value[0][0] = iter->neutral;
-                start.value[0][3] = (Byte) i;
-                Status plaintext = ComputePlaintext(start);
-                if (CheckPlaintext(plaintext)) {
-                    return plaintext;
-                }
-            }
-        }
-        return {};
+    AESLib::Word Structure::BackwardChunk(AESLib::Byte neutral) {
+        using namespace AESLib;
+        start.value[0][3] = neutral;
+        Status temp = BackwardComputation(start);
+        return (Word) temp.value[1][0] << 8 | temp.value[3][2];
+    }
+
+    AESLib::Status Structure::ComputePlaintext(AESLib::Byte forward_neutral, AESLib::Byte backward_neutral) {
+        start.value[0][0] = forward_neutral;
+        start.value[0][3] = backward_neutral;
+        return ComputePlaintext(start);
+    }
+
+    AESLib::Status Structure::Computation() {
+        return Attack::Computation(*this);
     }
 
     bool PartialMatch(const AESLib::Status &x, const AESLib::Status &y) {
@@ -143,7 +134,7 @@ namespace MITM4Round {
         Log::Normal(ss.str());
     }
 
-    void Run() {
+    void Run(const MITM::SearchOptions &options) {
         using namespace AESLib;
         using namespace std;
 
@@ -153,7 +144,7 @@ namespace MITM4Round {
                 0xab, 0xf7, 0x15, 0x88,
                 0x09, 0xcf, 0x4f, 0x3c,
         };
-        AES aes(key, 4, 4);
+        AES aes(key, 4, Config::ROUNDS);
 
         Status plaintext = Status(std::initializer_list<Byte>(
                 {
@@ -171,25 +162,42 @@ namespace MITM4Round {
 
         ShowCorrectStructure(aes, plaintext, h_n);
 
-        Status zero_status = {};
-        for (int i = 0;; i++) {
-            if (i % 10000 == 0) {
-                ss.str("");
-                ss << i << " structures have been tested.";
-                Log::Normal(ss.str());
-            }
-            Structure structure(aes, h_n);
-            Status temp = structure.Computation();
-            if (not(temp == zero_status)) {
-                ss.str("");
-                ss << "Found a solution! It spends " << i << " search to find." << endl
-                   << "Plaintext:" << endl
-                   << temp.ToString()
-                   << "H_n:" << endl
-                   << aes.CompressionFunction(temp).ToString();
-                Log::Correct(ss.str());
-                break;
-            }
+        Attack::Search(aes, h_n, options);
+    }
+
+    void Test() {
+        using namespace AESLib;
+
+        // A search saves the candidates it checked with its structures.
+        // With seed 7 it finds a solution within a hundred structures.
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key, 4, Config::ROUNDS);
+        Status h_n = aes.CompressionFunction(Status(std::initializer_list<Byte>(
+                {
+                        0x32, 0x88, 0x31, 0xe0,
+                        0x43, 0x5a, 0x31, 0x37,
+                        0xf6, 0x30, 0x98, 0x07,
+                        0xa8, 0x8d, 0xa2, 0x34,
+                }
+        )));
+        MITM::SearchOptions options;
+        options.checkpoint.state_path = "/tmp/aeshashmitm_mitm4_state_test_" + std::to_string(getpid());
+        options.checkpoint.seed = 7;
+        Attack::Search(aes, h_n, options);
+        Checkpoint::State state;
+        bool flag = Checkpoint::Load(options.checkpoint.state_path, state) && state.finished &&
+                    state.structure > 0 && state.candidates > 0;
+        std::remove(options.checkpoint.state_path.c_str());
+
+        if (flag) {
+            Log::Correct("MITM4Round search state test: passed");
+        } else {
+            Log::Error("MITM4Round search state test: failed");
         }
     }
 }
@@ -2,15 +2,20 @@
 #define AESHASHMITM_MITM_4_ROUND_H
 
 #include "aes.h"
+#include "checkpoint.h"
+#include "counter_random.h"
+#include "mitm_attack.h"
 
 namespace MITM4Round {
-    struct ChunkResult {
-        AESLib::Byte neutral;
-        AESLib::Word match;
+    // A match is the bytes at (1, 0) and (3, 2) of the state between the
+    // chunks. Its high byte spreads the 2^8 forward results of a structure
+    // over the buckets.
+    struct MatchKey {
+        static const int KEY_BITS = 8;
 
-        ChunkResult(AESLib::Byte neutral_, AESLib::Byte b10, AESLib::Byte b32);
-
-        bool operator<(ChunkResult y) const;
+        static AESLib::Word Of(AESLib::Word match) {
+            return match >> 8;
+        }
     };
 
     class Structure {
@@ -21,24 +26,54 @@ namespace MITM4Round {
         Structure(AESLib::AES aes_, AESLib::Status h_n_);
         Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::Status start_);
 
+        // A structure drawn from a random stream.
+        Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::RandomStream &random);
+
         void StartInit();
 
+        void StartInit(AESLib::RandomStream &random);
+
         [[nodiscard]] AESLib::Status ComputePlaintext(AESLib::Status status) const;
 
         [[nodiscard]] AESLib::Status ForwardComputation(AESLib::Status status) const;
 
         [[nodiscard]] static AESLib::Status BackwardComputation(AESLib::Status status);
 
+        // The forward matches of the neutrals 0 to 0xfe.
+        void ForwardChunk(AESLib::Word *match);
+
+        [[nodiscard]] AESLib::Word BackwardChunk(AESLib::Byte neutral);
+
+        [[nodiscard]] AESLib::Status ComputePlaintext(AESLib::Byte forward_neutral, AESLib::Byte backward_neutral);
+
         bool CheckPlaintext(AESLib::Status plaintext);
 
         AESLib::Status Computation();
     };
 
+    struct Config {
+        typedef MITM4Round::Structure StructureType;
+        typedef AESLib::Byte Neutral;
+        typedef MITM4Round::MatchKey Key;
+        static constexpr const char *NAME = "MITM4Round";
+        static constexpr int ROUNDS = 4;
+        static constexpr int FORWARD_COUNT = 0xff;
+        static constexpr int BACKWARD_COUNT = 0xff;
+    };
+
+    typedef MITM::MitmAttack<Config> Attack;
+
     bool PartialMatch(const AESLib::Status &x, const AESLib::Status &y);
 
     void ShowCorrectStructure(AESLib::AES aes, AESLib::Status plaintext, AESLib::Status h_n);
 
-    void Run();
+    // Search random structures on all hardware threads until one gives a
+    // solution. With a state path the progress is saved there every minute,
+    // and resume continues the search it holds. A shard searches every
+    // shard.count-th structure.
+    void Run(const MITM::SearchOptions &options = {});
+
+    void Test();
 }
 
 #endif //AESHASHMITM_MITM_4_ROUND_H
@@ -1,21 +1,27 @@
 #include "mitm_7_plus.h"
 
 #include "aes.h"
+#include "aes_simd.h"
+#include "checkpoint.h"
+#include "external_table.h"
 #include "log.h"
-#include <random>
-#include <set>
+#include "match_table.h"
+#include "metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <unistd.h>
 
 namespace MITM7Plus {
-    bool ChunkResult::operator<(MITM7Plus::ChunkResult y) const {
-        return match < y.match;
-    }
-
     Structure::Structure(AESLib::Status h_n_) {
         h_n = h_n_;
 
         Init();
+        InitBackward();
     }
 
     Structure::Structure(
@@ -40,19 +46,30 @@ namespace MITM7Plus {
         const_2[1] = const_2_1;
         const_2[2] = const_2_2;
         const_2[3] = const_2_3;
+
+        InitBackward();
+    }
+
+    Structure::Structure(AESLib::Status h_n_, AESLib::RandomStream &random) {
+        h_n = h_n_;
+
+        Init(random);
+        InitBackward();
     }
 
     void Structure::Init() {
-        std::random_device rd;
-        std::mt19937 mt(rd());
+        AESLib::RandomStream random = AESLib::NextRandomStream();
+        Init(random);
+    }
 
+    void Structure::Init(AESLib::RandomStream &random) {
         for (auto &i: const_key) {
-            i = mt();
+            i = random();
         }
-        const_0 = mt() & 0x0000ffff;
-        const_1 = mt() & 0x00ffffff;
+        const_0 = random() & 0x0000ffff;
+        const_1 = random() & 0x00ffffff;
         for (auto &i: const_2) {
-            i = mt() & 0x0000ffff;
+            i = random() & 0x0000ffff;
         }
     }
 
@@ -60,7 +77,7 @@ namespace MITM7Plus {
         // Neutral 1 is #key3[7]. Neutral 2 is #12[5].
         // The result is #key3[4, 5, 6, 7].
         using namespace AESLib;
-        static Byte solution[3][5] = {
+        static constexpr GFMulBy solution[3][5] = {
                 0xf7, 0x00, 0xf4, 0xf6, 0xf4,
                 0xf6, 0x01, 0xf4, 0xf5, 0xf6,
                 0xf6, 0x00, 0xf7, 0xf4, 0xf4,
@@ -76,7 +93,7 @@ namespace MITM7Plus {
         for (auto &i: solution) {
             Byte temp = 0;
             for (int j = 0; j < 5; j++) {
-                temp ^= GFMul(i[j], elements[j]);
+                temp ^= i[j](elements[j]);
             }
             neutral_key <<= 8;
             neutral_key |= temp;
@@ -114,7 +131,7 @@ namespace MITM7Plus {
 
     AESLib::Status Structure::CalculateForwardStart(AESLib::Word neutral) const {
         using namespace AESLib;
-        static Byte factor[4][2][3] = {
+        static constexpr GFMulBy factor[4][2][3] = {
                 0xd1, 0xb9, 0xd1,
                 0x69, 0xd1, 0x68,
                 0xd1, 0xd1, 0xb9,
@@ -128,16 +145,49 @@ namespace MITM7Plus {
         for (int col = 0; col < 4; col++) {
             for (int i = 0; i < 2; i++) {
                 ret.value[(i - col + 5) & 3][col] =
-                        GFMul(factor[col][i][0], ByteInWord(neutral, col)) ^
-                        GFMul(factor[col][i][1], const_2[col] >> 8 & 0xff) ^
-                        GFMul(factor[col][i][2], const_2[col] & 0xff);
+                        factor[col][i][0](ByteInWord(neutral, col)) ^
+                        factor[col][i][1](const_2[col] >> 8 & 0xff) ^
+                        factor[col][i][2](const_2[col] & 0xff);
             }
             ret.value[3 - col][col] = ByteInWord(neutral, col);
         }
         return ret;
     }
 
-    InitialStructure Structure::CreateInitialStructure(
+    void Structure::InitBackward() {
+        backward_key = GetKeySchedule(0);
+        backward_base = CreateStart(backward_key, 0, 0);
+    }
+
+    void Structure::BuildKeyCache(int thread_count) {
+        std::vector<KeySchedule> cache(0x10000);
+        AESLib::ParallelFor(thread_count, [&](int t) {
+            std::size_t end = AESLib::SliceBegin(cache.size(), t + 1, thread_count);
+            for (std::size_t i = AESLib::SliceBegin(cache.size(), t, thread_count); i < end; i++) {
+                cache[i] = GetKeySchedule((AESLib::Word) i);
+            }
+        });
+        key_cache.swap(cache);
+    }
+
+    KeySchedule Structure::GetKeySchedule(AESLib::Word forward_neutral) const {
+        using namespace AESLib;
+        if (not key_cache.empty()) {
+            return key_cache[forward_neutral & 0xffff];
+        }
+        AES aes = InvKeyGen(CalculateNeutralKey(
+                ByteInWord(forward_neutral, 3),
+                ByteInWord(forward_neutral, 2)
+        ));
+        KeySchedule ret;
+        for (int round = 0; round < 8; round++) {
+            ret.round_key[round] = aes.RoundKey(round);
+        }
+        return ret;
+    }
+
+    AESLib::Status Structure::CreateStart(
+            const KeySchedule &key,
             AESLib::Word forward_neutral,
             AESLib::Word backward_neutral
     ) const {
@@ -148,16 +198,12 @@ namespace MITM7Plus {
         status.value[1][1] = ByteInWord(forward_neutral, 2);
         status.value[2][2] = const_0 >> 8 & 0xff;
         status.value[3][3] = const_0 & 0xff;
-        AES aes = InvKeyGen(CalculateNeutralKey(
-                ByteInWord(forward_neutral, 3),
-                ByteInWord(forward_neutral, 2)
-        ));
 
         // We shouldn't add k3 to status, cause the #13 is the true backward start
         // since #12 = #13.
         // aes.AddRoundKey(status, 3);
 
-        aes.Round(status, 4);
+        RoundFast(status, key.round_key[4], false);
         status.SubBytes();
         status.ShiftRows();
 
@@ -168,10 +214,27 @@ namespace MITM7Plus {
                 status.value[row][col] = forward_start.value[row][col];
             }
         }
+        return status;
+    }
+
+    InitialStructure Structure::CreateInitialStructure(
+            AESLib::Word forward_neutral,
+            AESLib::Word backward_neutral
+    ) const {
+        using namespace AESLib;
+
+        AES aes = InvKeyGen(CalculateNeutralKey(
+                ByteInWord(forward_neutral, 3),
+                ByteInWord(forward_neutral, 2)
+        ));
+        KeySchedule key;
+        for (int round = 0; round < 8; round++) {
+            key.round_key[round] = aes.RoundKey(round);
+        }
 
         return {
                 aes,
-                status,
+                CreateStart(key, forward_neutral, backward_neutral),
         };
     }
 
@@ -188,11 +251,11 @@ namespace MITM7Plus {
 
         status.MixColumns();
         aes->AddRoundKey(status, 5);
-        aes->Round(status, 6);
-        aes->Round(status, 7);
+        aes->RoundFast(status, 6);
+        aes->RoundFast(status, 7);
         status += h_n;
         aes->AddRoundKey(status, 0);
-        aes->Round(status, 1);
+        aes->RoundFast(status, 1);
         status.SubBytes();
         status.ShiftRows();
 
@@ -208,78 +271,78 @@ namespace MITM7Plus {
         k_2.InvMixColumns();
         status += k_2;
 
-        return ForwardMatch(status);
+        return Match::Forward(status);
     }
 
-    AESLib::Byte Structure::ForwardMatch(const AESLib::Status &status, int col) {
+    void Structure::ForwardComputation(AESLib::Word key_neutral, AESLib::Word *match) const {
         using namespace AESLib;
-        static const int row1[4] = {0, 1, 0, 1};
-        static const int row2[4] = {2, 3, 2, 3};
-        static const Byte factor1[4] = {0xd, 0xd, 0xe, 0xe};
-        static const Byte factor2[4] = {0xe, 0xe, 0xd, 0xd};
-        return GFMul(factor1[col], status.value[row1[col]][col])
-               ^ GFMul(factor2[col], status.value[row2[col]][col]);
-    }
-
-    AESLib::Word Structure::ForwardMatch(const AESLib::Status &status) {
-        return AESLib::WordByByte(
-                ForwardMatch(status, 0),
-                0,
-                ForwardMatch(status, 2),
-                ForwardMatch(status, 3)
+        static constexpr GFMulBy mix_column[4] = {0x2, 0x1, 0x1, 0x3};
+
+        // Bytes 2 and 3 of the neutral fix the key and #12 except #12[0],
+        // which is byte 1. Byte 1 only reaches column 0 of round 4, and after
+        // SubBytes and ShiftRows the diagonal which is kept in #13. So the key
+        // schedule, k2 and everything up to AddRoundKey(5) but that diagonal's
+        // part of MixColumns are computed once for the 256 values of byte 1.
+        KeySchedule key = GetKeySchedule(key_neutral);
+        Status prefix = CreateStart(key, key_neutral & 0xffff, 0);
+        Word column_base = 0;
+        for (int row = 0; row < 4; row++) {
+            Byte &x = prefix.value[row][(4 - row) & 3];
+            column_base = column_base << 8 | INV_S_BOX[x];
+            x = 0;
+        }
+        Byte s_0 = S_BOX[0];
+        column_base ^= WordByByte(
+                mix_column[0](s_0), mix_column[1](s_0), mix_column[2](s_0), mix_column[3](s_0)
         );
+        prefix.MixColumns();
+        prefix += key.round_key[5];
+
+        Status k_2 = key.round_key[2];
+        k_2.InvMixColumns();
+        Status h_n_k_0 = h_n + key.round_key[0];
+
+        Status statuses[0x100];
+        for (int i = 0; i < 0x100; i++) {
+            Byte s = S_BOX[i];
+            Word column = column_base ^ WordByByte(
+                    mix_column[0](s), mix_column[1](s), mix_column[2](s), mix_column[3](s)
+            );
+            Status status = prefix + SubShiftMixColumn(column, 0);
+            RoundFast(status, key.round_key[6], false);
+            RoundFast(status, key.round_key[7], true);
+            status += h_n_k_0;
+            RoundFast(status, key.round_key[1], false);
+            status.SubBytes();
+            status.ShiftRows();
+            status += k_2;
+            statuses[i] = status;
+        }
+        Match::Forward(statuses, 0x100, match);
     }
 
     AESLib::Word Structure::BackwardComputation(AESLib::Word neutral) const {
         using namespace AESLib;
 
-        InitialStructure initial_structure = CreateInitialStructure(
-                0,
-                neutral
-        );
-
-        Status status = initial_structure.forward_start;
-        AES *aes = &initial_structure.aes;
+        // backward_base with the bytes CreateStart takes from the neutral.
+        Status status = backward_base;
+        Status forward_start = CalculateForwardStart(neutral);
+        for (int col = 0; col < 4; col++) {
+            for (int i = 0; i < 3; i++) {
+                int row = (i - col + 5) & 3;
+                status.value[row][col] = forward_start.value[row][col];
+            }
+        }
 
         status.InvShiftRows();
         status.InvSubBytes();
-        aes->InvRound(status, 4);
-        aes->InvRound(status, 3);
+        InvRoundFast(status, backward_key.round_key[4], false);
+        InvRoundFast(status, backward_key.round_key[3], false);
 
         // k2 should be added at forward chunk.
-        // aes->AddRoundKey(status, 2);
+        // AddRoundKey(status, 2);
 
-        return BackwardMatch(status);
-    }
-
-    AESLib::Byte Structure::BackwardMatch(const AESLib::Status &status, int col) {
-        using namespace AESLib;
-        static const Byte matrix[4][4] = {
-                0xe, 0xb, 0xd, 0x9,
-                0x9, 0xe, 0xb, 0xd,
-                0xd, 0x9, 0xe, 0xb,
-                0xb, 0xd, 0x9, 0xe,
-        };
-        static const int row1[4] = {0, 1, 0, 1};
-        static const int row2[4] = {2, 3, 2, 3};
-        static const Byte factor1[4] = {0xd, 0xd, 0xe, 0xe};
-        static const Byte factor2[4] = {0xe, 0xe, 0xd, 0xd};
-        Byte c_0 = GFMul(matrix[row1[col]][col], status.value[col][col]);
-        Byte c_1 = GFMul(matrix[row2[col]][col], status.value[col][col]);
-        for (int i = 0; i < 4; i++) {
-            c_0 ^= GFMul(matrix[row1[col]][i], status.value[i][col]);
-            c_1 ^= GFMul(matrix[row2[col]][i], status.value[i][col]);
-        }
-        return GFMul(factor1[col], c_0) ^ GFMul(factor2[col], c_1);
-    }
-
-    AESLib::Word Structure::BackwardMatch(const AESLib::Status &status) {
-        return AESLib::WordByByte(
-                BackwardMatch(status, 0),
-                0,
-                BackwardMatch(status, 2),
-                BackwardMatch(status, 3)
-        );
+        return Match::Backward(status);
     }
 
     bool Structure::CheckNeutral(
@@ -287,55 +350,242 @@ namespace MITM7Plus {
     ) const {
         using namespace AESLib;
 
-        InitialStructure initial_structure = CreateInitialStructure(
-                forward_neutral,
-                backward_neutral
-        );
-        Status status = initial_structure.forward_start;
-        AES *aes = &initial_structure.aes;
+        KeySchedule key = GetKeySchedule(forward_neutral);
+        Status status = CreateStart(key, forward_neutral, backward_neutral);
 
         status.MixColumns();
-        aes->AddRoundKey(status, 5);
-        aes->Round(status, 6);
-        aes->Round(status, 7);
+        status += key.round_key[5];
+        RoundFast(status, key.round_key[6], false);
+        RoundFast(status, key.round_key[7], true);
         status += h_n;
-        return aes->CompressionFunction(status) == h_n;
+        // One column of the digest rules out all but 2^-32 of the wrong
+        // matches before the full digest is computed.
+        return CompressionColumnFast(status, key.round_key, 7, 0) == h_n.Column(0) &&
+               CompressionFunctionFast(status, key.round_key, 7) == h_n;
+    }
+
+    // Statistics of one backward worker, on its own cache line.
+    struct alignas(64) ProbeCounter {
+        std::uint64_t candidates = 0;   // Matches which went to CheckNeutral.
+    };
+
+    std::uint64_t Structure::ForwardKey(const NeutralRange &range) const {
+        using namespace AESLib;
+        const char tag[] = "MITM7Plus forward";
+        Byte h_n_bytes[16];
+        for (int i = 0; i < 16; i++) {
+            h_n_bytes[i] = h_n.value[i & 3][i >> 2];
+        }
+        std::uint64_t hash = Hash64(tag, sizeof(tag));
+        hash = Hash64(h_n_bytes, sizeof(h_n_bytes), hash);
+        hash = Hash64(const_key, sizeof(const_key), hash);
+        hash = Hash64(&const_0, sizeof(const_0), hash);
+        hash = Hash64(&const_1, sizeof(const_1), hash);
+        hash = Hash64(&range.forward_begin, sizeof(range.forward_begin), hash);
+        hash = Hash64(&range.forward_end, sizeof(range.forward_end), hash);
+        return Hash64(const_2, sizeof(const_2), hash);
     }
 
-    Result Structure::Compute() {
+    // One block per key, that is per bytes 2 and 3 of the neutral, with byte 1
+    // running inside the block.
+    void Structure::ForwardBlock(AESLib::Word key_neutral, ChunkResult *results) const {
+        using namespace AESLib;
+        Word match[0x100];
+        ForwardComputation(key_neutral, match);
+        for (int i = 0; i < 0x100; i++) {
+            results[i] = {
+                    (Word) i << 16 | key_neutral,
+                    match[i]
+            };
+        }
+    }
+
+    Result Structure::Compute(
+            int thread_count,
+            Checkpoint::Checkpointer *checkpointer,
+            const Checkpoint::Shard &shard
+    ) {
         using namespace AESLib;
         using namespace std;
 
-        multiset<ChunkResult> forward_results = {};
-        for (int i = 0; i < 0xffffff; i++) {
-            forward_results.insert(ChunkResult(
-                    {
-                            (Word) i,
-                            ForwardComputation(i)
-                    }
-            ));
-        }
-
-        for (int i = 0; i < 0xffff; i++) {
-            for (int j = 0; j < 0xffff; j++) {
-                Word neutral = (Word) i << 16 | j;
-                ChunkResult backward_result = {
-                        neutral,
-                        BackwardComputation(neutral)
-                };
-                auto iter = forward_results.lower_bound(backward_result);
-                for (; iter != forward_results.end() &&
-                       iter->match == backward_result.match; iter++) {
-                    if (CheckNeutral(iter->neutral, backward_result.neutral)) {
-                        return {
-                                iter->neutral,
-                                backward_result.neutral
-                        };
+        using Metrics::Counter;
+
+        Metrics::Tally tally;
+        tally.Add(Counter::Structures);
+        {
+            // Every chunk and the final check take their round keys from here.
+            Metrics::ScopedTimer timer(Metrics::Phase::Setup);
+            BuildKeyCache(thread_count);
+        }
+
+        BucketTable<ChunkResult, MatchKey> forward_results;
+        {
+            Metrics::ScopedTimer timer(Metrics::Phase::Forward);
+            forward_results.GenerateBlocks(0x10000, 0x100, [this](size_t block, ChunkResult *results) {
+                ForwardBlock((Word) block, results);
+            }, thread_count);
+            forward_results.Build(thread_count);
+            tally.Add(Counter::ForwardEvaluations, forward_results.Size());
+        }
+        tally.Flush();
+
+        // The backward neutrals are probed in chunks of 2^16 values. Workers
+        // take the next chunk from a shared counter, so no worker idles while
+        // chunks are left, and all of them stop once one finds a solution.
+        // A shard probes its slice of the chunks only. Its checkpointer counts
+        // the chunks of the slice, and a resumed search starts after the ones
+        // it had finished.
+        const int first_chunk = (int) Checkpoint::ShardBegin(0xffff, shard.index, shard.count);
+        const int chunk_count = (int) Checkpoint::ShardBegin(0xffff, shard.index + 1, shard.count) - first_chunk;
+        atomic<int> next_chunk(checkpointer == nullptr ? 0 : (int) checkpointer->Current().backward);
+        atomic<bool> found(false);
+        Result result = {};
+        vector<ProbeCounter> counters(thread_count);
+        ParallelFor(thread_count, [&](int t) {
+            ProbeCounter &counter = counters[t];
+            Metrics::Tally worker_tally;
+            for (int i = next_chunk++; i < chunk_count; i = next_chunk++) {
+                Metrics::ScopedTimer timer(Metrics::Phase::Backward);
+                uint64_t chunk_candidates = counter.candidates;
+                for (int j = 0; j < 0xffff && not found.load(memory_order_relaxed); j++) {
+                    Word neutral = (Word) (first_chunk + i) << 16 | j;
+                    ChunkResult backward_result = {
+                            neutral,
+                            BackwardComputation(neutral)
+                    };
+                    auto range = forward_results.Bucket(backward_result.match);
+                    worker_tally.Add(Counter::BackwardEvaluations);
+                    worker_tally.Add(Counter::Pairs, forward_results.Size());
+                    worker_tally.Probe(range.second - range.first);
+                    for (auto iter = range.first; iter != range.second; iter++) {
+                        if (iter->match != backward_result.match) {
+                            continue;
+                        }
+                        counter.candidates++;
+                        worker_tally.Add(Counter::Verifications);
+                        if (CheckNeutral(iter->neutral, backward_result.neutral)) {
+                            if (not found.exchange(true)) {
+                                result.forward_neutral = iter->neutral;
+                                result.backward_neutral = backward_result.neutral;
+                            }
+                            break;
+                        }
+                        worker_tally.Add(Counter::FalsePositives);
                     }
                 }
+                worker_tally.Flush();
+                if (found.load(memory_order_relaxed)) {
+                    break;
+                }
+                if (checkpointer != nullptr) {
+                    checkpointer->Done(i, counter.candidates - chunk_candidates);
+                }
+            }
+        });
+        for (auto &counter: counters) {
+            result.candidate_count += counter.candidates;
+        }
+        // The workers only stop early on a solution, so without one every
+        // chunk of the shard is done.
+        if (checkpointer != nullptr && not found.load()) {
+            checkpointer->Exhaust();
+        }
+        return result;
+    }
+
+    Result Structure::ComputeExternal(
+            const std::string &prefix,
+            std::size_t run_size,
+            int thread_count,
+            Checkpoint::Checkpointer *checkpointer,
+            const NeutralRange &range
+    ) {
+        using namespace AESLib;
+        using namespace std;
+
+        using Metrics::Counter;
+
+        Metrics::Tally tally;
+        tally.Add(Counter::Structures);
+        {
+            Metrics::ScopedTimer timer(Metrics::Phase::Setup);
+            BuildKeyCache(thread_count);
+        }
+
+        ExternalTable<ChunkResult> forward_results(prefix, run_size);
+        const Word forward_blocks = range.forward_end - range.forward_begin;
+        if (forward_results.Load(ForwardKey(range))) {
+            Log::Normal("MITM7Plus: reusing the forward table " + prefix + ".index");
+        } else {
+            Metrics::ScopedTimer timer(Metrics::Phase::Forward);
+            bool ok = forward_results.GenerateBlocks(forward_blocks, 0x100, [&](size_t block, ChunkResult *results) {
+                ForwardBlock(range.forward_begin + (Word) block, results);
+            }, thread_count);
+            if (not ok || not forward_results.Build(ForwardKey(range))) {
+                Log::Error("MITM7Plus: building the external forward table failed");
+                return {};
+            }
+            forward_results.Keep();
+            tally.Add(Counter::ForwardEvaluations, (uint64_t) forward_blocks << 8);
+        }
+        tally.Flush();
+
+        // A worker computes a whole chunk of backward results, sorts it by
+        // match and joins it with the index in one forward pass. The chunks
+        // are counted from the start of the range, as Compute counts them
+        // from the start of its shard.
+        const int chunk_count = (int) (range.backward_end - range.backward_begin);
+        atomic<int> next_chunk(checkpointer == nullptr ? 0 : (int) checkpointer->Current().backward);
+        atomic<bool> found(false);
+        Result result = {};
+        vector<ProbeCounter> counters(thread_count);
+        ParallelFor(thread_count, [&](int t) {
+            ProbeCounter &counter = counters[t];
+            Metrics::Tally worker_tally;
+            MatchTable<ChunkResult> backward_results;
+            for (int i = next_chunk++; i < chunk_count && not found.load(memory_order_relaxed); i = next_chunk++) {
+                Metrics::ScopedTimer timer(Metrics::Phase::Backward);
+                uint64_t chunk_candidates = counter.candidates;
+                backward_results.Resize(0xffff);
+                ChunkResult *chunk = backward_results.Data();
+                for (int j = 0; j < 0xffff; j++) {
+                    Word neutral = (range.backward_begin + i) << 16 | j;
+                    chunk[j] = {neutral, BackwardComputation(neutral)};
+                }
+                backward_results.Sort();
+                // The join merges sorted runs instead of probing buckets, so
+                // only the pairs and the verifications are counted.
+                worker_tally.Add(Counter::BackwardEvaluations, 0xffff);
+                worker_tally.Add(Counter::Pairs, (uint64_t) 0xffff * forward_results.Size());
+                forward_results.Join(
+                        backward_results.Data(), backward_results.Size(),
+                        [&](const ChunkResult &forward_result, const ChunkResult &backward_result) {
+                            counter.candidates++;
+                            worker_tally.Add(Counter::Verifications);
+                            if (not CheckNeutral(forward_result.neutral, backward_result.neutral)) {
+                                worker_tally.Add(Counter::FalsePositives);
+                                return found.load(memory_order_relaxed);
+                            }
+                            if (not found.exchange(true)) {
+                                result.forward_neutral = forward_result.neutral;
+                                result.backward_neutral = backward_result.neutral;
+                            }
+                            return true;
+                        }
+                );
+                worker_tally.Flush();
+                if (checkpointer != nullptr && not found.load(memory_order_relaxed)) {
+                    checkpointer->Done(i, counter.candidates - chunk_candidates);
+                }
             }
+        });
+        for (auto &counter: counters) {
+            result.candidate_count += counter.candidates;
+        }
+        if (checkpointer != nullptr && not found.load()) {
+            checkpointer->Exhaust();
         }
-        return {};
+        return result;
     }
 
     void Structure::Test(
@@ -412,6 +662,48 @@ namespace MITM7Plus {
         } else {
             Log::Error("Correct neutral test: failed");
         }
+
+        bool incremental_flag = true;
+        for (Word key_neutral: {forward_neutral & 0xffff, (Word) 0x0000, (Word) 0xa55a, (Word) 0xffff}) {
+            Word match[0x100];
+            ForwardComputation(key_neutral, match);
+            for (int i = 0; i < 0x100; i++) {
+                if (match[i] != ForwardComputation((Word) i << 16 | key_neutral)) {
+                    incremental_flag = false;
+                }
+            }
+        }
+        if (incremental_flag) {
+            Log::Correct("Incremental forward test: passed");
+        } else {
+            Log::Error("Incremental forward test: failed");
+        }
+
+        // The external table on a range around the correct neutrals, in runs
+        // of a few blocks which have to be merged. The second run maps the
+        // index of the first and computes no forward results.
+        std::string prefix = "/tmp/aeshashmitm_external_compute_test_" + std::to_string(getpid());
+        NeutralRange range;
+        range.forward_begin = (forward_neutral & 0xffff) - 7;
+        range.forward_end = (forward_neutral & 0xffff) + 9;
+        range.backward_begin = backward_neutral >> 16;
+        range.backward_end = (backward_neutral >> 16) + 1;
+        bool external_flag = true;
+        for (int run = 0; run < 2; run++) {
+            std::uint64_t forward_before = Metrics::Collect().Count(Metrics::Counter::ForwardEvaluations);
+            Result result = ComputeExternal(prefix, 1000, DefaultThreadCount(), nullptr, range);
+            std::uint64_t forward_count =
+                    Metrics::Collect().Count(Metrics::Counter::ForwardEvaluations) - forward_before;
+            external_flag = external_flag && result.forward_neutral == forward_neutral &&
+                            result.backward_neutral == backward_neutral &&
+                            forward_count == (run == 0 ? 16 * 0x100 : 0);
+        }
+        external_flag = external_flag && std::remove((prefix + ".index").c_str()) == 0;
+        if (external_flag) {
+            Log::Correct("External compute test: passed");
+        } else {
+            Log::Error("External compute test: failed");
+        }
     }
 
     Structure GenerateCorrectStructure(
@@ -493,17 +785,55 @@ namespace MITM7Plus {
         structure.Test(aes, 0x481d3e, 0x7cae6c97);
     }
 
-    void Attack(AESLib::Status h_n) {
+    void Attack(AESLib::Status h_n, const MITM::SearchOptions &options) {
         using namespace AESLib;
         using namespace std;
-        Structure structure(h_n);
-        Result result = structure.Compute();
+
+        Checkpoint::State state;
+        if (not Checkpoint::Begin("MITM7Plus", options.checkpoint, state)) {
+            return;
+        }
+        if (state.finished) {
+            Log::Normal("The search in " + options.checkpoint.state_path + " has already found a solution.");
+            return;
+        }
+        if (state.exhausted) {
+            Log::Normal("The search in " + options.checkpoint.state_path + " has already probed all its chunks.");
+            return;
+        }
+        // The seed and a structure index are all it takes to replay a structure.
+        Log::Normal("Seed: " + std::to_string(state.seed));
+        Checkpoint::Checkpointer checkpointer(options.checkpoint.state_path, state, &Checkpoint::State::backward);
+        Metrics::Reporter reporter(options.metrics_path, DefaultThreadCount(), options.metrics_interval);
+
+        // The structure of the search is drawn from its seed alone, so that
+        // all shards of a search share it.
+        CounterRandom random(state.seed);
+        RandomStream stream = random.Stream(0);
+        Structure structure(h_n, stream);
+        Result result;
+        if (options.external_prefix.empty()) {
+            result = structure.Compute(DefaultThreadCount(), &checkpointer, state.shard);
+        } else {
+            // The same slice of the backward chunks as Compute takes.
+            NeutralRange range;
+            range.backward_begin = (Word) Checkpoint::ShardBegin(0xffff, state.shard.index, state.shard.count);
+            range.backward_end = (Word) Checkpoint::ShardBegin(0xffff, state.shard.index + 1, state.shard.count);
+            result = structure.ComputeExternal(
+                    options.external_prefix, options.external_run_size, DefaultThreadCount(), &checkpointer, range
+            );
+        }
         if (not(result.backward_neutral == 0 && result.forward_neutral == 0)) {
+            stringstream solution;
+            solution << hex << setw(8) << setfill('0') << result.forward_neutral
+                     << setw(8) << setfill('0') << result.backward_neutral;
+            checkpointer.Finish(solution.str());
             stringstream ss;
             ss.str("");
             ss << "Found a solution!" << endl
                << "Forward neutral: " << hex << result.forward_neutral << endl
-               << "Backward neutral: " << hex << result.backward_neutral << endl;
+               << "Backward neutral: " << hex << result.backward_neutral << endl
+               << "Candidates checked: " << dec << checkpointer.Current().candidates << endl;
             Log::Correct(ss.str());
         }
     }
@@ -2,13 +2,36 @@
 #define AESHASHMITM_MITM_7_PLUS_H
 
 #include "aes.h"
+#include "checkpoint.h"
+#include "counter_random.h"
+#include "mitm_attack.h"
+#include "parallel.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace MITM7Plus {
-    struct ChunkResult {
-        AESLib::Word neutral;   // The value of #12[0], #12[5] and #k3[7].
-        AESLib::Word match;     // The calculated match value of 3 columns.
+    // The neutral is the value of #12[0], #12[5] and #k3[7], and the match
+    // the calculated match value of 3 columns.
+    typedef MITM::ChunkResult<AESLib::Word> ChunkResult;
 
-        bool operator<(ChunkResult y) const;
+    // Column 1 is not matched.
+    typedef MITM::MixColumnsMatch<0xd> Match;
+
+    // The matches of both chunks have 0 in byte 1, see Match, so the
+    // other 3 bytes index the forward results directly.
+    struct MatchKey {
+        static const int KEY_BITS = 24;
+
+        static AESLib::Word Of(AESLib::Word match) {
+            return (match >> 8 & 0xff0000) | (match & 0xffff);
+        }
+    };
+
+    // The round keys 0 to 7 of the 7 round AES which a neutral key gives.
+    struct KeySchedule {
+        AESLib::Status round_key[8];
     };
 
     struct InitialStructure {
@@ -17,8 +40,20 @@ namespace MITM7Plus {
     };
 
     struct Result {
-        AESLib::Word forward_neutral;
-        AESLib::Word backward_neutral;
+        AESLib::Word forward_neutral = 0;
+        AESLib::Word backward_neutral = 0;
+        std::uint64_t candidate_count = 0;  // Forward and backward pairs with equal matches.
+    };
+
+    // The neutrals a computation covers, as [begin, end) of the forward
+    // blocks, that is of bytes 2 and 3 of the forward neutral, and of the
+    // backward chunks of 2^16 neutrals. Everything by default; a shard or a
+    // test takes less.
+    struct NeutralRange {
+        AESLib::Word forward_begin = 0;
+        AESLib::Word forward_end = 0x10000;
+        AESLib::Word backward_begin = 0;
+        AESLib::Word backward_end = 0xffff;
     };
 
     class Structure {
@@ -29,14 +64,34 @@ namespace MITM7Plus {
         AESLib::Word const_1 = 0;       // 3 bytes values for impacts from #12[5] and k3[4, 5, 6, 7] on #11[5, 6, 7].
         AESLib::Word const_2[4] = {};   // 8 bytes values for impacts from #19[1, 2, 3; ...] on #20[0, 2; ...].
 
+        // The key schedules of all 2^16 key neutrals, bytes 2 and 3 of the
+        // forward neutral, once BuildKeyCache has run.
+        std::vector<KeySchedule> key_cache;
+
+        // The backward chunk always runs with forward neutral 0, so its key
+        // and the bytes of #13 it does not set are fixed.
+        KeySchedule backward_key;
+        AESLib::Status backward_base;
+
         void Init();
 
-        [[nodiscard]] AESLib::Word CalculateNeutralKey(AESLib::Byte neutral_1, AESLib::Byte neutral_2) const;
+        void Init(AESLib::RandomStream &random);
 
-        [[nodiscard]] AESLib::AES InvKeyGen(AESLib::Word neutral_key) const;
+        void InitBackward();
+
+        [[nodiscard]] KeySchedule GetKeySchedule(AESLib::Word forward_neutral) const;
+
+        [[nodiscard]] AESLib::Word CalculateNeutralKey(AESLib::Byte neutral_1, AESLib::Byte neutral_2) const;
 
         [[nodiscard]] AESLib::Status CalculateForwardStart(AESLib::Word neutral) const;
 
+        // #13 from the key schedule of forward_neutral.
+        [[nodiscard]] AESLib::Status CreateStart(
+                const KeySchedule &key,
+                AESLib::Word forward_neutral,
+                AESLib::Word backward_neutral
+        ) const;
+
         [[nodiscard]] InitialStructure CreateInitialStructure(
                 AESLib::Word forward_neutral,
                 AESLib::Word backward_neutral
@@ -44,24 +99,20 @@ namespace MITM7Plus {
 
         [[nodiscard]] AESLib::Word ForwardComputation(AESLib::Word neutral) const;
 
-        [[nodiscard]] static AESLib::Byte ForwardMatch(const AESLib::Status &status, int col);
-
-        [[nodiscard]] static AESLib::Word ForwardMatch(const AESLib::Status &status);
-
-        [[nodiscard]] AESLib::Word BackwardComputation(AESLib::Word neutral) const;
-
-        [[nodiscard]] static AESLib::Byte BackwardMatch(const AESLib::Status &status, int col);
+        // The matches of the 256 neutrals byte << 16 | key_neutral at once,
+        // with the part which byte does not change computed once.
+        void ForwardComputation(AESLib::Word key_neutral, AESLib::Word *match) const;
 
-        [[nodiscard]] static AESLib::Word BackwardMatch(const AESLib::Status &status);
-
-        [[nodiscard]] bool CheckNeutral(
-                AESLib::Word forward_neutral,
-                AESLib::Word backward_neutral
-        ) const;
+        // A hash of h_n, the constants and the forward range, which decide
+        // the forward table.
+        [[nodiscard]] std::uint64_t ForwardKey(const NeutralRange &range) const;
 
     public:
         explicit Structure(AESLib::Status h_n_);
 
+        // A structure drawn from a random stream.
+        Structure(AESLib::Status h_n_, AESLib::RandomStream &random);
+
         Structure(
                 AESLib::Status h_n_,
                 AESLib::Word const_key_0,
@@ -75,7 +126,47 @@ namespace MITM7Plus {
                 AESLib::Word const_2_3
         );
 
-        Result Compute();
+        // The steps of Compute, public for the benchmarks. BuildKeyCache
+        // fills the key schedules which the others take from then on.
+        void BuildKeyCache(int thread_count);
+
+        [[nodiscard]] AESLib::AES InvKeyGen(AESLib::Word neutral_key) const;
+
+        // The 256 results of ForwardComputation(key_neutral, match).
+        void ForwardBlock(AESLib::Word key_neutral, ChunkResult *results) const;
+
+        [[nodiscard]] AESLib::Word BackwardComputation(AESLib::Word neutral) const;
+
+        [[nodiscard]] bool CheckNeutral(
+                AESLib::Word forward_neutral,
+                AESLib::Word backward_neutral
+        ) const;
+
+        // The forward table is built and the backward neutrals are probed on
+        // thread_count workers. A shard probes its slice of the backward
+        // chunks only. With a checkpointer, its backward cursor says where to
+        // start in the slice, finished chunks are reported to it, and it is told
+        // when the slice is exhausted without a solution.
+        Result Compute(
+                int thread_count = AESLib::DefaultThreadCount(),
+                Checkpoint::Checkpointer *checkpointer = nullptr,
+                const Checkpoint::Shard &shard = {}
+        );
+
+        // Compute with the forward table on disk, for when it does not fit in
+        // memory. The table is written to files starting with prefix, in
+        // sorted runs of run_size results which are merged and mapped. The
+        // index prefix.index is kept, and later runs on the same structure
+        // and forward range map it instead of computing the forward chunk
+        // again. The checkpointer is used as in Compute, with the backward
+        // chunks counted from the start of range.
+        Result ComputeExternal(
+                const std::string &prefix,
+                std::size_t run_size,
+                int thread_count = AESLib::DefaultThreadCount(),
+                Checkpoint::Checkpointer *checkpointer = nullptr,
+                const NeutralRange &range = {}
+        );
 
         void Test(
                 const AESLib::AES &aes,
@@ -86,7 +177,12 @@ namespace MITM7Plus {
 
     void Test();
 
-    void Attack();
+    // Search a random structure for h_n. With a state path the progress is
+    // saved there every minute, and resume continues the search it holds.
+    // With a metrics path the metrics of the search are written there every
+    // metrics interval, and with an external prefix the forward table is
+    // kept on disk, see Structure::ComputeExternal.
+    void Attack(AESLib::Status h_n, const MITM::SearchOptions &options = {});
 }
 
 #endif //AESHASHMITM_MITM_7_PLUS_H
@@ -1,19 +1,18 @@
 #include "mitm_7_round.h"
 
 #include "aes.h"
+#include "aes_ni.h"
+#include "aes_simd.h"
+#include "checkpoint.h"
 #include "log.h"
+#include <algorithm>
 #include <random>
-#include <set>
 #include <sstream>
 #include <thread>
 #include <vector>
 
 namespace MITM7Round {
 
-    bool ChunkResult::operator<(MITM7Round::ChunkResult y) const {
-        return match < y.match;
-    }
-
     Structure::Structure(AESLib::AES aes_, AESLib::Status h_n_) {
         aes = aes_;
         h_n = h_n_;
@@ -33,22 +32,33 @@ namespace MITM7Round {
         aes.AddRoundKey(forward_start, 4);
         forward_start.SubBytes();
         forward_start.ShiftRows();
+
+        InitForwardPrefix();
+    }
+
+    Structure::Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::RandomStream &random) {
+        aes = aes_;
+        h_n = h_n_;
+
+        Init(random);
     }
 
     void Structure::Init() {
+        AESLib::RandomStream random = AESLib::NextRandomStream();
+        Init(random);
+    }
+
+    void Structure::Init(AESLib::RandomStream &random) {
         using namespace AESLib;
         using namespace std;
 
-        random_device rd;
-        mt19937 mt(rd());
-
-        const_1 = mt() & 0x00ffffff;
-        const_2 = mt() & 0x0000ffff;
+        const_1 = random() & 0x00ffffff;
+        const_2 = random() & 0x0000ffff;
         backward_start = Status(initializer_list<Word>{
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt()),
-                static_cast<unsigned int>(mt())
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random()),
+                static_cast<unsigned int>(random())
         });
 
         // These codes are for ensuring the constraints of neutral bytes correct.
@@ -74,6 +84,34 @@ namespace MITM7Round {
         aes.AddRoundKey(forward_start, 4);
         forward_start.SubBytes();
         forward_start.ShiftRows();
+
+        InitForwardPrefix();
+    }
+
+    void Structure::InitForwardPrefix() {
+        using namespace AESLib;
+
+        // Column 0 of round 4 is linear in the neutral byte before SubBytes.
+        Status temp = {};
+        for (int i = 1; i < 4; i++) {
+            temp.value[i][0] = ByteInWord(const_1, i);
+        }
+        temp.MixColumns();
+        aes.AddRoundKey(temp, 4);
+        forward_column_base = temp.Column(0);
+
+        // The rest of forward_start reaches every byte through MixColumns, so
+        // the prefix ends at AddRoundKey(5).
+        forward_prefix = forward_start;
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                if (FORWARD_NEUTRAL_MASK.Has(row, col)) {
+                    forward_prefix.value[row][col] = 0;
+                }
+            }
+        }
+        forward_prefix.MixColumns();
+        aes.AddRoundKey(forward_prefix, 5);
     }
 
     AESLib::Status Structure::GetForwardNeutral(AESLib::Byte neutral_byte) const {
@@ -92,15 +130,31 @@ namespace MITM7Round {
         return temp;
     }
 
-    inline AESLib::Word Structure::CalculateBackwardBytes(AESLib::Byte neutral_byte) const {
+    AESLib::Status Structure::GetForwardStart(AESLib::Byte neutral_byte) const {
         using namespace AESLib;
+        Status start = forward_start;
+        Status forward_neutral = GetForwardNeutral(neutral_byte);
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                if (FORWARD_NEUTRAL_MASK.Has(row, col)) {
+                    start.value[row][col] = forward_neutral.value[row][col];
+                }
+            }
+        }
+        return start;
+    }
+
+    AESLib::Word Structure::CalculateBackwardBytes(AESLib::Byte neutral_byte) const {
+        using namespace AESLib;
+        static constexpr GFMulBy factor_1 = 0xd1;
+        static constexpr GFMulBy factor_2 = 0x69;
         Byte c_1 = const_2 >> 8 & 0xff;
         Byte c_2 = const_2 & 0xff;
-        return (GFMul(0xd1, neutral_byte) ^ c_1) << 8 |
-               (GFMul(0x69, neutral_byte) ^ c_2);
+        return (factor_1(neutral_byte) ^ c_1) << 8 |
+               (factor_2(neutral_byte) ^ c_2);
     }
 
-    inline AESLib::Status Structure::GetBackwardNeutral(AESLib::Byte neutral_byte) const {
+    AESLib::Status Structure::GetBackwardNeutral(AESLib::Byte neutral_byte) const {
         AESLib::Word backward_bytes = CalculateBackwardBytes(neutral_byte);
         AESLib::Status temp = {};
         temp.value[0][3] = neutral_byte;
@@ -114,11 +168,11 @@ namespace MITM7Round {
         return temp;
     }
 
-    inline AESLib::Status Structure::ComputePlaintext(AESLib::Status status) const {
+    AESLib::Status Structure::ComputePlaintext(AESLib::Status status) const {
         status.MixColumns();
         aes.AddRoundKey(status, 5);
-        aes.Round(status, 6);
-        aes.Round(status, 7);
+        aes.RoundFast(status, 6);
+        aes.RoundFast(status, 7);
         status += h_n;
         return status;
     }
@@ -139,122 +193,114 @@ namespace MITM7Round {
         return start;
     }
 
-    inline AESLib::Status Structure::ForwardComputation(AESLib::Status status) const {
+    AESLib::Status Structure::ForwardComputation(AESLib::Status status) const {
         status = ComputePlaintext(status);
         aes.AddRoundKey(status, 0);
-        aes.Round(status, 1);
+        aes.RoundFast(status, 1);
         status.SubBytes();
         status.ShiftRows();
         return status;
     }
 
-    inline AESLib::Status Structure::BackwardComputation(AESLib::Status status) const {
+    AESLib::Status Structure::IncrementalForwardComputation(AESLib::Byte neutral_byte) const {
+        return ForwardSuffix(IncrementalForwardPrefix(neutral_byte));
+    }
+
+    AESLib::Status Structure::IncrementalForwardPrefix(AESLib::Byte neutral_byte) const {
+        using namespace AESLib;
+        static constexpr GFMulBy mix_column[4] = {0x2, 0x1, 0x1, 0x3};
+
+        // Round 4 sends column 0 to the neutral bytes, and MixColumns of
+        // round 5 adds their part to the prefix.
+        Word column = forward_column_base ^ WordByByte(
+                mix_column[0](neutral_byte),
+                mix_column[1](neutral_byte),
+                mix_column[2](neutral_byte),
+                mix_column[3](neutral_byte)
+        );
+        Status status = forward_prefix + SubShiftMixColumn(column, 0);
+        aes.RoundFast(status, 6);
+        aes.RoundFast(status, 7);
+        return status;
+    }
+
+    AESLib::Status Structure::ForwardSuffix(AESLib::Status status) const {
+        status += h_n;
+        aes.AddRoundKey(status, 0);
+        aes.RoundFast(status, 1);
+        status.SubBytes();
+        status.ShiftRows();
+        return status;
+    }
+
+    std::vector<AESLib::ByteMask> Structure::ForwardDependency() {
+        using namespace AESLib;
+        std::vector<ByteMask> ret = {FORWARD_NEUTRAL_MASK};
+        ret.push_back(ret.back().MixColumns());   // AddRoundKey(5).
+        ret.push_back(ret.back().Round());        // Round 6.
+        ret.push_back(ret.back().ShiftRows());    // Round 7 has no MixColumns.
+        ret.push_back(ret.back());                // Feed-forward and AddRoundKey(0).
+        ret.push_back(ret.back().Round());        // Round 1.
+        ret.push_back(ret.back().ShiftRows());    // SubBytes and ShiftRows.
+        return ret;
+    }
+
+    AESLib::Status Structure::BackwardComputation(AESLib::Status status) const {
         status.InvMixColumns();
         status.InvShiftRows();
         status.InvSubBytes();
-        aes.InvRound(status, 3);
+        aes.InvRoundFast(status, 3);
         aes.AddRoundKey(status, 2);
         return status;
     }
 
-    inline AESLib::Byte Structure::ForwardMatch(AESLib::Status status, int col) {
-        using namespace AESLib;
-        static const int row1[4] = {0, 1, 0, 1};
-        static const int row2[4] = {2, 3, 2, 3};
-        static const Byte factor1[4] = {0xd, 0xd, 0xe, 0xe};
-        static const Byte factor2[4] = {0xe, 0xe, 0xd, 0xd};
-        return GFMul(factor1[col], status.value[row1[col]][col])
-               ^ GFMul(factor2[col], status.value[row2[col]][col]);
+    // The same as PartialMatch(aes.CompressionFunctionFast(plaintext), h_n),
+    // which compares column 0 only, without the rest of the last round.
+    bool Structure::CheckPlaintext(AESLib::Status plaintext) const {
+        return aes.CompressionColumnFast(plaintext, 0) == h_n.Column(0);
     }
 
-    AESLib::Word Structure::ForwardMatch(AESLib::Status status) {
-        AESLib::Word ret = 0;
-        for (int i = 0; i < 4; i++) {
-            ret <<= 8;
-            ret |= ForwardMatch(status, i);
-        }
-        return ret;
+    // The incremental scalar path beats the bitsliced batch here, since only
+    // the rounds after the cached prefix are left per neutral.
+    void Structure::ForwardChunk(AESLib::Word *match) const {
+        AESLib::Status prefix[Config::FORWARD_COUNT];
+        ForwardPrefix(prefix);
+        ForwardChunk(prefix, match);
     }
 
-    AESLib::Byte Structure::BackwardMatch(AESLib::Status status, int col) {
-        using namespace AESLib;
-        static const Byte matrix[4][4] = {
-                0xe, 0xb, 0xd, 0x9,
-                0x9, 0xe, 0xb, 0xd,
-                0xd, 0x9, 0xe, 0xb,
-                0xb, 0xd, 0x9, 0xe,
-        };
-        static const int row1[4] = {0, 1, 0, 1};
-        static const int row2[4] = {2, 3, 2, 3};
-        static const Byte factor1[4] = {0xd, 0xd, 0xe, 0xe};
-        static const Byte factor2[4] = {0xe, 0xe, 0xd, 0xd};
-        Byte c_0 = GFMul(matrix[row1[col]][col], status.value[col][col]);
-        Byte c_1 = GFMul(matrix[row2[col]][col], status.value[col][col]);
-        for (int i = 0; i < 4; i++) {
-            c_0 ^= GFMul(matrix[row1[col]][i], status.value[i][col]);
-            c_1 ^= GFMul(matrix[row2[col]][i], status.value[i][col]);
+    void Structure::ForwardPrefix(AESLib::Status *prefix) const {
+        for (int i = 0; i < Config::FORWARD_COUNT; i++) {
+            prefix[i] = IncrementalForwardPrefix((AESLib::Byte) i);
         }
-        return GFMul(factor1[col], c_0) ^ GFMul(factor2[col], c_1);
     }
 
-    AESLib::Word Structure::BackwardMatch(AESLib::Status status) {
-        AESLib::Word ret = 0;
-        for (int i = 0; i < 4; i++) {
-            ret <<= 8;
-            ret |= BackwardMatch(status, i);
+    void Structure::ForwardChunk(const AESLib::Status *prefix, AESLib::Word *match) const {
+        AESLib::Status temp[Config::FORWARD_COUNT];
+        for (int i = 0; i < Config::FORWARD_COUNT; i++) {
+            temp[i] = ForwardSuffix(prefix[i]);
         }
-        return ret;
+        Match::Forward(temp, Config::FORWARD_COUNT, match);
     }
 
-    inline bool Structure::CheckPlaintext(AESLib::Status plaintext) const {
-        return PartialMatch(aes.CompressionFunction(plaintext), h_n);
+    void Structure::SetTarget(const AESLib::Status &h_n_) {
+        h_n = h_n_;
     }
 
-    AESLib::Status Structure::Computation() {
+    AESLib::Word Structure::BackwardChunk(AESLib::Byte neutral_byte) {
         using namespace AESLib;
-        using namespace std;
-
-        multiset<ChunkResult> forward_results = {};
-        for (int i = 0; i < 0xff; i++) {
-            Status forward_neutral = GetForwardNeutral((Byte) i);
-            for (int j = 0; j < 4; j++) {
-                int k = (4 - j) & 3;
-                forward_start.value[j][k] = forward_neutral.value[j][k];
-            }
-            Status temp = ForwardComputation(forward_start);
-            forward_results.insert(ChunkResult(
-                    {
-                            (Byte) i,
-                            ForwardMatch(temp)
-                    }
-            ));
-        }
+        Status backward_neutral = GetBackwardNeutral(neutral_byte);
+        backward_start.value[0][3] = backward_neutral.value[0][3];
+        backward_start.value[2][1] = backward_neutral.value[2][1];
+        backward_start.value[3][2] = backward_neutral.value[3][2];
+        return Match::Backward(BackwardComputation(backward_start));
+    }
 
-        for (int i = 0; i < 0xff; i++) {
-            Status backward_neutral = GetBackwardNeutral((Byte) i);
-            backward_start.value[0][3] = backward_neutral.value[0][3];
-            backward_start.value[2][1] = backward_neutral.value[2][1];
-            backward_start.value[3][2] = backward_neutral.value[3][2];
-            Status temp = BackwardComputation(backward_start);
-            ChunkResult backward_result = {
-                    (Byte) i,
-                    BackwardMatch(temp)
-            };
-            auto iter = forward_results.lower_bound(backward_result);
-            for (; iter != forward_results.end() &&
-                   iter->match == backward_result.match; iter++) {
-                Status start = ComputeStart(iter->neutral, (Byte) i);
-                Status plaintext = ComputePlaintext(start);
-                stringstream ss;
-                ss << endl << aes.CompressionFunction(plaintext).ToString();
-                Log::Normal(ss.str());
-                if (CheckPlaintext(plaintext)) {
-                    return plaintext;
-                }
-            }
-        }
+    AESLib::Status Structure::ComputePlaintext(AESLib::Byte forward_neutral, AESLib::Byte backward_neutral) const {
+        return ComputePlaintext(ComputeStart(forward_neutral, backward_neutral));
+    }
 
-        return {};
+    AESLib::Status Structure::Computation() {
+        return Attack::Computation(*this);
     }
 
     bool PartialMatch(const AESLib::Status &x, const AESLib::Status &y) {
@@ -267,25 +313,7 @@ namespace MITM7Round {
         return true;
     }
 
-    void Attack(AESLib::AES aes, AESLib::Status h_n, int search_number, bool &success_flag) {
-        using namespace AESLib;
-        using namespace std;
-        Structure structure(aes, h_n);
-        Status temp = structure.Computation();
-        if (not(temp == Status())) {
-            stringstream ss;
-            ss.str("");
-            ss << "Found a solution! It spends " << search_number << " search to find."
-               << "Plaintext:" << endl
-               << temp.ToString()
-               << "H_n:" << endl
-               << aes.CompressionFunction(temp).ToString();
-            Log::Correct(ss.str());
-            success_flag = true;
-        }
-    }
-
-    void Run() {
+    void Run(const MITM::SearchOptions &options) {
         using namespace AESLib;
         using namespace std;
 
@@ -295,7 +323,7 @@ namespace MITM7Round {
                 0xab, 0xf7, 0x15, 0x88,
                 0x09, 0xcf, 0x4f, 0x3c,
         };
-        AES aes(key, 4, 7);
+        AES aes(key, 4, Config::ROUNDS);
 
         Status plaintext = Status(std::initializer_list<Byte>(
                 {
@@ -313,30 +341,41 @@ namespace MITM7Round {
 
         ShowCorrectStructure(aes, plaintext, h_n);
 
-        thread threads[8];
-        bool success_flag = false;
-        for (int i = 0;; i += 8) {
-            if (i % 10000 == 0) {
-                ss.str("");
-                ss << i << " structures have been tested.";
-                Log::Normal(ss.str());
-            }
-            for (auto & j : threads) {
-                j = thread(Attack, aes, h_n, i, ref(success_flag));
-            }
-            for (auto & thread : threads) {
-                thread.join();
-            }
-            if (success_flag) {
-                break;
-            }
+        Attack::Search(aes, h_n, options);
+    }
+
+    void RunTargets(const std::string &targets_path, const MITM::SearchOptions &options) {
+        using namespace AESLib;
+
+        std::vector<Status> targets;
+        if (not MITM::LoadTargets(targets_path, targets)) {
+            return;
         }
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key, 4, Config::ROUNDS);
+        Log::Normal("Search started for " + std::to_string(targets.size()) + " targets from " + targets_path + ".");
+        Attack::SearchTargets(aes, targets, options);
     }
 
-    void ShowCorrectStructure(AESLib::AES aes, AESLib::Status plaintext, AESLib::Status h_n) {
+    // The constants of the structure which holds plaintext, and the neutrals
+    // which give it. They don't depend on h_n.
+    struct CorrectStructure {
+        AESLib::Byte neutral_1;
+        AESLib::Byte neutral_2;
+        AESLib::Word const_1;
+        AESLib::Word const_2;
+        AESLib::Status start;
+    };
+
+    static CorrectStructure FindCorrectStructure(const AESLib::AES &aes, const AESLib::Status &plaintext) {
         using namespace AESLib;
-        using namespace std;
 
+        CorrectStructure correct = {};
         Status temp = plaintext;
         aes.AddRoundKey(temp, 0);
         aes.Round(temp, 1);
@@ -344,36 +383,43 @@ namespace MITM7Round {
         aes.Round(temp, 3);
         temp.SubBytes();
         temp.ShiftRows();
-        Byte correct_neutral_1 = temp.value[0][0];
-        Word correct_const_1 = 0;
+        correct.neutral_1 = temp.value[0][0];
         for (int i = 1; i < 4; i++) {
-            correct_const_1 <<= 8;
-            correct_const_1 |= temp.value[i][0];
+            correct.const_1 <<= 8;
+            correct.const_1 |= temp.value[i][0];
         }
         temp.MixColumns();
-        Status correct_start = temp;
+        correct.start = temp;
         aes.AddRoundKey(temp, 4);
         temp.SubBytes();
         temp.ShiftRows();
-        Byte correct_neutral_2 = temp.value[0][3];
+        correct.neutral_2 = temp.value[0][3];
         Byte c_1 = temp.value[0][3] ^ GFMul(3, temp.value[2][3]) ^ temp.value[3][3];
         Byte c_2 = GFMul(3, temp.value[0][3]) ^ temp.value[2][3] ^ GFMul(2, temp.value[3][3]);
-        Word correct_const_2 = (GFMul(0xb9, c_1) ^ GFMul(0xd1, c_2)) << 8 |
-                               (GFMul(0xd1, c_1) ^ GFMul(0x68, c_2));
+        correct.const_2 = (GFMul(0xb9, c_1) ^ GFMul(0xd1, c_2)) << 8 |
+                          (GFMul(0xd1, c_1) ^ GFMul(0x68, c_2));
+        return correct;
+    }
+
+    void ShowCorrectStructure(AESLib::AES aes, AESLib::Status plaintext, AESLib::Status h_n) {
+        using namespace AESLib;
+        using namespace std;
+
+        CorrectStructure correct = FindCorrectStructure(aes, plaintext);
         Structure correct_structure(aes, h_n,
-                                    correct_const_1, correct_const_2,
-                                    correct_start);
+                                    correct.const_1, correct.const_2,
+                                    correct.start);
 
         Status correct_res = correct_structure.Computation();
         Status correct_h_n = aes.CompressionFunction(correct_res);
         stringstream ss;
         ss << "Here are the correct structure." << endl
-           << "Neutral 1: " << hex << (int) correct_neutral_1 << " "
-           << "Neutral 2: " << hex << (int) correct_neutral_2 << endl
-           << "Const value 1: " << hex << correct_const_1 << endl
-           << "Const value 2: " << hex << correct_const_2 << endl
+           << "Neutral 1: " << hex << (int) correct.neutral_1 << " "
+           << "Neutral 2: " << hex << (int) correct.neutral_2 << endl
+           << "Const value 1: " << hex << correct.const_1 << endl
+           << "Const value 2: " << hex << correct.const_2 << endl
            << "Start:" << endl
-           << correct_start.ToString()
+           << correct.start.ToString()
            << "H_n:" << endl
            << correct_h_n.ToString()
            << "Result:" << endl
@@ -394,13 +440,13 @@ namespace MITM7Round {
         ));
         Status after_match = before_match;
         after_match.MixColumns();
-        if (Structure::ForwardMatch(before_match) == Structure::BackwardMatch(after_match)) {
+        if (Structure::Match::Forward(before_match) == Structure::Match::Backward(after_match)) {
             Log::Correct("Match test: passed");
         } else {
             stringstream ss;
             ss << "Match test: failed" << endl
-               << hex << Structure::ForwardMatch(before_match) << " "
-               << hex << Structure::BackwardMatch(after_match) << endl;
+               << hex << Structure::Match::Forward(before_match) << " "
+               << hex << Structure::Match::Backward(after_match) << endl;
             Log::Error(ss.str());
         }
 
@@ -425,5 +471,175 @@ namespace MITM7Round {
         } else {
             Log::Error("Backward neutral factor wrong.");
         }
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key, 4, 7);
+        bool incremental_test = true;
+        for (int i = 0; i < 16; i++) {
+            Structure structure(aes, before_match);
+            for (int neutral = 0; neutral <= 0xff; neutral++) {
+                Status start = structure.GetForwardStart((Byte) neutral);
+                if (not(structure.IncrementalForwardComputation((Byte) neutral) ==
+                        structure.ForwardComputation(start))) {
+                    incremental_test = false;
+                }
+            }
+        }
+        vector<ByteMask> dependency = Structure::ForwardDependency();
+        if (not(dependency[1] == ByteMask::All() && dependency.back() == ByteMask::All())) {
+            incremental_test = false;
+        }
+        if (incremental_test) {
+            Log::Correct("Incremental forward test: passed");
+        } else {
+            Log::Error("Incremental forward test: failed");
+        }
+
+        // Joined with several targets at once, a structure hits the targets
+        // it hits alone. The correct structure of a plaintext hits its digest.
+        Status plaintext = Status(std::initializer_list<Byte>(
+                {
+                        0x32, 0x88, 0x31, 0xe0,
+                        0x43, 0x5a, 0x31, 0x37,
+                        0xf6, 0x30, 0x98, 0x07,
+                        0xa8, 0x8d, 0xa2, 0x34,
+                }
+        ));
+        Status h_n = aes.CompressionFunction(plaintext);
+        vector<Status> targets = {before_match, h_n, after_match};
+        CorrectStructure correct = FindCorrectStructure(aes, plaintext);
+        CounterRandom random(0x7a26);
+        bool multi_target_test = true;
+        for (int i = 0; i < 8; i++) {
+            RandomStream stream = random.Stream(i);
+            Structure structure = i == 0 ? Structure(aes, h_n, correct.const_1, correct.const_2, correct.start)
+                                         : Structure(aes, h_n, stream);
+            vector<Status> hits;
+            Attack::Computation(structure, targets, hits);
+            for (size_t t = 0; t < targets.size(); t++) {
+                Structure single = structure;
+                single.SetTarget(targets[t]);
+                Status result = single.Computation();
+                multi_target_test = multi_target_test && (result == Status()) == (hits[t] == Status()) &&
+                                    (hits[t] == Status() || PartialMatch(aes.CompressionFunction(hits[t]), targets[t]));
+            }
+            if (i == 0) {
+                multi_target_test = multi_target_test && not(hits[1] == Status());
+            }
+        }
+        if (multi_target_test) {
+            Log::Correct("Multi-target test: passed");
+        } else {
+            Log::Error("Multi-target test: failed");
+        }
+    }
+
+    // Everything a structure computes on the way to its result, so that
+    // runs on different threads can be compared value by value.
+    static std::vector<AESLib::Word> StructureDigest(Structure structure, const AESLib::AES &aes) {
+        using namespace AESLib;
+        using namespace std;
+
+        vector<Word> digest;
+        for (int i = 0; i <= 0xff; i++) {
+            Status start = structure.ComputeStart((Byte) i, (Byte) (i ^ 0x5a));
+            digest.push_back(Structure::Match::Forward(structure.ForwardComputation(start)));
+            digest.push_back(Structure::Match::Backward(structure.BackwardComputation(start)));
+            Status temp = start;
+            temp.MixColumns();
+            digest.push_back(temp.Column(i & 3));
+            temp.InvMixColumns();
+            digest.push_back(temp == start);
+            Status plaintext = structure.ComputePlaintext(start);
+            digest.push_back(aes.Cipher(plaintext).Column(0));
+            digest.push_back(aes.CompressionFunctionFast(plaintext).Column(1));
+        }
+        Status result = structure.Computation();
+        for (int col = 0; col < 4; col++) {
+            digest.push_back(result.Column(col));
+        }
+        return digest;
+    }
+
+    // Run the same structures on one thread and on many threads at once, for
+    // every backend and SIMD level, and compare the results. Build with
+    // AESHASHMITM_TSAN to have ThreadSanitizer watch the shared state.
+    void ThreadTest() {
+        using namespace AESLib;
+        using namespace std;
+
+        const int structure_count = 32;
+        const int thread_count = 8;
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key, 4, 7);
+        mt19937 mt(0x7e57);
+        Status h_n = Status(initializer_list<Word>{
+                static_cast<unsigned int>(mt()),
+                static_cast<unsigned int>(mt()),
+                static_cast<unsigned int>(mt()),
+                static_cast<unsigned int>(mt())
+        });
+        vector<Structure> structures;
+        for (int i = 0; i < structure_count; i++) {
+            Word const_1 = mt() & 0x00ffffff;
+            Word const_2 = mt() & 0x0000ffff;
+            Status backward_start = Status(initializer_list<Word>{
+                    static_cast<unsigned int>(mt()),
+                    static_cast<unsigned int>(mt()),
+                    static_cast<unsigned int>(mt()),
+                    static_cast<unsigned int>(mt())
+            });
+            structures.emplace_back(aes, h_n, const_1, const_2, backward_start);
+        }
+
+        Backend default_backend = GetBackend();
+        SIMDLevel default_level = GetSIMDLevel();
+        bool thread_test = true;
+        for (Backend backend: {Backend::Portable, Backend::AESNI}) {
+            if (backend == Backend::AESNI && not HasAESNI()) {
+                continue;
+            }
+            SetBackend(backend);
+            for (SIMDLevel level: {SIMDLevel::Scalar, GetSupportedSIMDLevel()}) {
+                SetSIMDLevel(level);
+                vector<vector<Word>> expected(structure_count);
+                for (int i = 0; i < structure_count; i++) {
+                    expected[i] = StructureDigest(structures[i], aes);
+                }
+
+                vector<vector<Word>> actual(structure_count);
+                vector<thread> threads;
+                for (int t = 0; t < thread_count; t++) {
+                    threads.emplace_back([&, t]() {
+                        for (int i = t; i < structure_count; i += thread_count) {
+                            actual[i] = StructureDigest(structures[i], aes);
+                        }
+                    });
+                }
+                for (auto &thread: threads) {
+                    thread.join();
+                }
+                if (actual != expected) {
+                    thread_test = false;
+                }
+            }
+        }
+        SetSIMDLevel(default_level);
+        SetBackend(default_backend);
+
+        if (thread_test) {
+            Log::Correct("Thread test: passed");
+        } else {
+            Log::Error("Thread test: failed");
+        }
     }
 }
@@ -2,13 +2,22 @@
 #define AESHASHMITM_MITM_7_ROUND_H
 
 #include "aes.h"
+#include "checkpoint.h"
+#include "counter_random.h"
+#include "mitm_attack.h"
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace MITM7Round {
-    struct ChunkResult {
-        AESLib::Byte neutral;
-        AESLib::Word match;
-
-        bool operator<(ChunkResult y) const;
+    // A structure has only 2^8 forward results, so the highest byte of the
+    // match is enough to spread them over the buckets.
+    struct MatchKey {
+        static const int KEY_BITS = 8;
+
+        static AESLib::Word Of(AESLib::Word match) {
+            return match >> 24;
+        }
     };
 
     class Structure {
@@ -19,16 +28,39 @@ namespace MITM7Round {
         AESLib::Word const_2 = 0;
         AESLib::Status backward_start;
         AESLib::Status forward_start;
+
+        // The forward chunk up to AddRoundKey(5) with the neutral bytes left
+        // out, and column 0 before round 4's SubBytes with the neutral 0. See
+        // IncrementalForwardComputation.
+        AESLib::Word forward_column_base = 0;
+        AESLib::Status forward_prefix;
+
+        void InitForwardPrefix();
     public:
+        typedef MITM::MixColumnsMatch<0xf> Match;
+
+        // The bytes of forward_start which the forward neutral sets.
+        static constexpr AESLib::ByteMask FORWARD_NEUTRAL_MASK =
+                AESLib::ByteMask::At(0, 0) | AESLib::ByteMask::At(1, 3) |
+                AESLib::ByteMask::At(2, 2) | AESLib::ByteMask::At(3, 1);
+
         Structure(AESLib::AES aes_, AESLib::Status h_n_);
 
         Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::Word const_1_, AESLib::Word const_2_,
                   AESLib::Status backward_start_);
 
+        // A structure drawn from a random stream.
+        Structure(AESLib::AES aes_, AESLib::Status h_n_, AESLib::RandomStream &random);
+
         void Init();
 
+        void Init(AESLib::RandomStream &random);
+
         [[nodiscard]] AESLib::Status GetForwardNeutral(AESLib::Byte neutral_byte) const;
 
+        // forward_start with the bytes set by the forward neutral.
+        [[nodiscard]] AESLib::Status GetForwardStart(AESLib::Byte neutral_byte) const;
+
         [[nodiscard]] AESLib::Word CalculateBackwardBytes(AESLib::Byte neutral_byte) const;
 
         [[nodiscard]] AESLib::Status GetBackwardNeutral(AESLib::Byte neutral_byte) const;
@@ -39,30 +71,78 @@ namespace MITM7Round {
 
         [[nodiscard]] AESLib::Status ForwardComputation(AESLib::Status status) const;
 
+        // ForwardComputation(GetForwardStart(neutral_byte)) from the cached
+        // prefix. Only round 4's column 0 and the neutral bytes' part of
+        // MixColumns are computed per neutral, and then the rounds after it.
+        [[nodiscard]] AESLib::Status IncrementalForwardComputation(AESLib::Byte neutral_byte) const;
+
+        // IncrementalForwardComputation up to the feed-forward, and the rest
+        // of it. Only the rest depends on h_n.
+        [[nodiscard]] AESLib::Status IncrementalForwardPrefix(AESLib::Byte neutral_byte) const;
+
+        [[nodiscard]] AESLib::Status ForwardSuffix(AESLib::Status status) const;
+
+        // The bytes which depend on the forward neutral after each step of
+        // the forward chunk: the start, AddRoundKey(5), round 6, round 7, the
+        // feed-forward with AddRoundKey(0), round 1, and SubBytes with
+        // ShiftRows before the match.
+        [[nodiscard]] static std::vector<AESLib::ByteMask> ForwardDependency();
+
         [[nodiscard]] AESLib::Status BackwardComputation(AESLib::Status status) const;
 
-        [[nodiscard]] bool CheckPlaintext(AESLib::Status plaintext) const;
+        // The forward matches of the neutrals 0 to 0xfe.
+        void ForwardChunk(AESLib::Word *match) const;
 
-        AESLib::Status Computation();
+        // The forward chunk of the neutrals 0 to 0xfe up to the feed-forward,
+        // and their matches from there.
+        void ForwardPrefix(AESLib::Status *prefix) const;
 
-        [[nodiscard]] static AESLib::Byte ForwardMatch(AESLib::Status status, int col);
+        void ForwardChunk(const AESLib::Status *prefix, AESLib::Word *match) const;
 
-        [[nodiscard]] static AESLib::Word ForwardMatch(AESLib::Status status);
+        // Attack h_n_ instead, which the rest of the structure doesn't depend on.
+        void SetTarget(const AESLib::Status &h_n_);
 
-        [[nodiscard]] static AESLib::Byte BackwardMatch(AESLib::Status status, int col);
+        // The backward match of neutral_byte. It leaves the backward neutral
+        // in backward_start.
+        [[nodiscard]] AESLib::Word BackwardChunk(AESLib::Byte neutral_byte);
+
+        [[nodiscard]] AESLib::Status ComputePlaintext(AESLib::Byte forward_neutral, AESLib::Byte backward_neutral) const;
+
+        [[nodiscard]] bool CheckPlaintext(AESLib::Status plaintext) const;
 
-        [[nodiscard]] static AESLib::Word BackwardMatch(AESLib::Status status);
+        AESLib::Status Computation();
+    };
+
+    struct Config {
+        typedef MITM7Round::Structure StructureType;
+        typedef AESLib::Byte Neutral;
+        typedef MITM7Round::MatchKey Key;
+        static constexpr const char *NAME = "MITM7Round";
+        static constexpr int ROUNDS = 7;
+        static constexpr int FORWARD_COUNT = 0xff;
+        static constexpr int BACKWARD_COUNT = 0xff;
     };
 
+    typedef MITM::MitmAttack<Config> Attack;
+
     [[nodiscard]] bool PartialMatch(const AESLib::Status &x, const AESLib::Status &y);
 
     void ShowCorrectStructure(AESLib::AES aes, AESLib::Status plaintext, AESLib::Status h_n);
 
-    void Attack(AESLib::AES aes, AESLib::Status h_n, int search_number, bool &success_flag);
+    // Search random structures on all hardware threads until one gives a
+    // solution. With a state path the progress is saved there every minute,
+    // and resume continues the search it holds. A shard searches every
+    // shard.count-th structure.
+    void Run(const MITM::SearchOptions &options = {});
 
-    void Run();
+    // Search random structures for all the digests in the file at
+    // targets_path at once, as MITM::LoadTargets reads it, until each of them
+    // is hit. Otherwise as Run.
+    void RunTargets(const std::string &targets_path, const MITM::SearchOptions &options = {});
 
     void Test();
+
+    void ThreadTest();
 }
 
 #endif //AESHASHMITM_MITM_7_ROUND_H
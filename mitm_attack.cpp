@@ -0,0 +1,91 @@
+#include "mitm_attack.h"
+
+#include "aes.h"
+#include "external_table.h"
+#include "log.h"
+#include <fstream>
+#include <random>
+
+namespace MITM {
+    bool LoadTargets(const std::string &path, std::vector<AESLib::Status> &targets) {
+        using namespace AESLib;
+        using namespace std;
+
+        ifstream file(path);
+        if (not file) {
+            Log::Error("Can't open " + path);
+            return false;
+        }
+        vector<Status> loaded;
+        string line;
+        for (int number = 1; getline(file, line); number++) {
+            stringstream ss(line);
+            string text;
+            if (not(ss >> text) || text[0] == '#') {
+                continue;
+            }
+            Status target;
+            if (not Status::FromHex(text, target)) {
+                Log::Error(path + ":" + to_string(number) + " is not a digest of 32 hex digits");
+                return false;
+            }
+            loaded.push_back(target);
+        }
+        if (loaded.empty()) {
+            Log::Error(path + " has no targets");
+            return false;
+        }
+        targets = loaded;
+        return true;
+    }
+
+    std::uint64_t TargetsKey(const std::vector<AESLib::Status> &targets) {
+        const char tag[] = "MITM targets";
+        std::uint64_t hash = AESLib::Hash64(tag, sizeof(tag));
+        for (const AESLib::Status &target: targets) {
+            hash = AESLib::Hash64(target.value.data, sizeof(target.value.data), hash);
+        }
+        return hash;
+    }
+
+    void Test() {
+        using namespace AESLib;
+        using namespace std;
+
+        // The matches agree through MixColumns whatever the diagonal, for
+        // all the columns or some, and the columns left out are 0.
+        mt19937 mt(0x3a7c);
+        bool flag = true;
+        Status statuses[16];
+        Word ret[16];
+        for (int i = 0; i < 16; i++) {
+            Status x = Status(initializer_list<Word>{
+                    static_cast<Word>(mt()),
+                    static_cast<Word>(mt()),
+                    static_cast<Word>(mt()),
+                    static_cast<Word>(mt())
+            });
+            Status y = x;
+            y.MixColumns();
+            Status z = y;
+            for (int col = 0; col < 4; col++) {
+                z.value[col][col] ^= (Byte) mt();
+            }
+            flag = flag && MixColumnsMatch<0xf>::Forward(x) == MixColumnsMatch<0xf>::Backward(y) &&
+                   MixColumnsMatch<0xf>::Forward(x) == MixColumnsMatch<0xf>::Backward(z) &&
+                   MixColumnsMatch<0xd>::Forward(x) == MixColumnsMatch<0xd>::Backward(z) &&
+                   MixColumnsMatch<0xd>::Forward(x) == (MixColumnsMatch<0xf>::Forward(x) & 0xff00ffff);
+            statuses[i] = x;
+        }
+        MixColumnsMatch<0xf>::Forward(statuses, 16, ret);
+        for (int i = 0; i < 16; i++) {
+            flag = flag && ret[i] == MixColumnsMatch<0xf>::Forward(statuses[i]);
+        }
+
+        if (flag) {
+            Log::Correct("MITM match test: passed");
+        } else {
+            Log::Error("MITM match test: failed");
+        }
+    }
+}
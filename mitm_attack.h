@@ -0,0 +1,424 @@
+#ifndef AESHASHMITM_MITM_ATTACK_H
+#define AESHASHMITM_MITM_ATTACK_H
+
+#include "aes.h"
+#include "aes_simd.h"
+#include "checkpoint.h"
+#include "counter_random.h"
+#include "log.h"
+#include "match_table.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The parts of the MITM attacks which don't depend on the attack: the chunk
+// results, the match through MixColumns, the join of the chunks within a
+// structure and the search over random structures.
+namespace MITM {
+    // How a search runs: its checkpoints, and what else it does on the side.
+    struct SearchOptions {
+        Checkpoint::Options checkpoint;
+        std::string metrics_path;       // Empty for no metrics, see Metrics::Reporter.
+        std::chrono::seconds metrics_interval = std::chrono::seconds(10);
+        std::string external_prefix;    // Empty to keep the MITM7Plus forward table in memory.
+        std::size_t external_run_size = (std::size_t) 1 << 22;     // Results per sorted run on disk.
+    };
+
+    // A result of either chunk: the neutral it was computed from and its
+    // match value.
+    template<typename Neutral>
+    struct ChunkResult {
+        Neutral neutral;
+        AESLib::Word match;
+
+        bool operator<(ChunkResult y) const {
+            return match < y.match;
+        }
+    };
+
+    // The match through a MixColumns between the chunks. The forward chunk
+    // knows the state x before it, and the backward chunk the state after it,
+    // MixColumns(x), but one byte of each column of it, the one on the
+    // diagonal. In column col the forward match is
+    //     factor_1 * x[row_1] ^ factor_2 * x[row_2],
+    // and the backward match is the same with x[row_1] and x[row_2] from
+    // InvMixColumns, where the factors cancel the unknown byte. So
+    // Forward(x) == Backward(MixColumns(x)) whatever the diagonal.
+    //
+    // Bit col of COLUMNS is set when column col is matched. The other
+    // columns are 0 in both matches.
+    template<unsigned COLUMNS>
+    struct MixColumnsMatch {
+        static constexpr int ROW_1[4] = {0, 1, 0, 1};
+        static constexpr int ROW_2[4] = {2, 3, 2, 3};
+        static constexpr AESLib::GFMulBy FACTOR_1[4] = {0xd, 0xd, 0xe, 0xe};
+        static constexpr AESLib::GFMulBy FACTOR_2[4] = {0xe, 0xe, 0xd, 0xd};
+        static constexpr AESLib::GFMulBy INV_MIX[4][4] = {
+                0xe, 0xb, 0xd, 0x9,
+                0x9, 0xe, 0xb, 0xd,
+                0xd, 0x9, 0xe, 0xb,
+                0xb, 0xd, 0x9, 0xe,
+        };
+
+        [[nodiscard]] static AESLib::Byte Forward(const AESLib::Status &status, int col) {
+            if (not(COLUMNS >> col & 1)) {
+                return 0;
+            }
+            return FACTOR_1[col](status.value[ROW_1[col]][col])
+                   ^ FACTOR_2[col](status.value[ROW_2[col]][col]);
+        }
+
+        [[nodiscard]] static AESLib::Byte Backward(const AESLib::Status &status, int col) {
+            using namespace AESLib;
+            if (not(COLUMNS >> col & 1)) {
+                return 0;
+            }
+            Byte c_0 = 0;
+            Byte c_1 = 0;
+            for (int i = 0; i < 4; i++) {
+                if (i != col) {
+                    c_0 ^= INV_MIX[ROW_1[col]][i](status.value[i][col]);
+                    c_1 ^= INV_MIX[ROW_2[col]][i](status.value[i][col]);
+                }
+            }
+            return FACTOR_1[col](c_0) ^ FACTOR_2[col](c_1);
+        }
+
+        // Both matches are linear forms on the columns, so the whole words
+        // are computed by the SIMD kernels.
+        [[nodiscard]] static const AESLib::ColumnForm &ForwardForm() {
+            static const AESLib::ColumnForm form(
+                    [](const AESLib::Status &x, int col) { return Forward(x, col); }
+            );
+            return form;
+        }
+
+        [[nodiscard]] static const AESLib::ColumnForm &BackwardForm() {
+            static const AESLib::ColumnForm form(
+                    [](const AESLib::Status &x, int col) { return Backward(x, col); }
+            );
+            return form;
+        }
+
+        [[nodiscard]] static AESLib::Word Forward(const AESLib::Status &status) {
+            return ForwardForm()(status);
+        }
+
+        static void Forward(const AESLib::Status *statuses, int n, AESLib::Word *ret) {
+            ForwardForm()(statuses, n, ret);
+        }
+
+        [[nodiscard]] static AESLib::Word Backward(const AESLib::Status &status) {
+            return BackwardForm()(status);
+        }
+
+        static void Backward(const AESLib::Status *statuses, int n, AESLib::Word *ret) {
+            BackwardForm()(statuses, n, ret);
+        }
+    };
+
+    // Read the targets of a multi-target search from path, one digest in hex
+    // per line as Status::ToHex writes it. Empty lines and lines starting
+    // with # are skipped. Returns false and logs when a line is not a digest.
+    bool LoadTargets(const std::string &path, std::vector<AESLib::Status> &targets);
+
+    // A hash of targets, for telling the states of multi-target searches
+    // apart.
+    std::uint64_t TargetsKey(const std::vector<AESLib::Status> &targets);
+
+    // An attack on random structures, each small enough to be joined on one
+    // thread. Config describes the attack:
+    //     StructureType    the structure, constructible from
+    //                      (AES, h_n, RandomStream &), with
+    //                      void ForwardChunk(Word *match), the matches of the
+    //                          forward neutrals 0 to FORWARD_COUNT - 1,
+    //                      Word BackwardChunk(Neutral neutral),
+    //                      Status ComputePlaintext(Neutral forward, Neutral backward)
+    //                          for a pair of equal matches, and
+    //                      bool CheckPlaintext(Status plaintext) const.
+    //     Neutral          the type of a neutral.
+    //     Key              the bucket key of the matches, as for BucketTable.
+    //     NAME             the name of the search in its state files.
+    //     ROUNDS           the rounds of the AES under attack.
+    //     FORWARD_COUNT    the forward neutrals of a structure.
+    //     BACKWARD_COUNT   the backward neutrals of a structure.
+    // For SearchTargets the structure splits the forward chunk at the
+    // feed-forward, where h_n comes in, with
+    //                      void ForwardPrefix(Status *prefix), the forward
+    //                          chunk up to the feed-forward, which doesn't
+    //                          depend on h_n,
+    //                      void ForwardChunk(const Status *prefix, Word *match),
+    //                          the rest of it, and
+    //                      void SetTarget(const Status &h_n).
+    // The chunks themselves depend on the key schedule and the constants of
+    // each attack and are written by hand.
+    template<typename Config>
+    class MitmAttack {
+    public:
+        typedef typename Config::StructureType Structure;
+        typedef typename Config::Neutral Neutral;
+        typedef ChunkResult<Neutral> Result;
+        typedef AESLib::BucketTable<Result, typename Config::Key> Table;
+
+        static_assert(Config::FORWARD_COUNT <= (std::uint64_t) 1 << 8 * sizeof(Neutral) &&
+                      Config::BACKWARD_COUNT <= (std::uint64_t) 1 << 8 * sizeof(Neutral),
+                      "Every neutral has to fit in Neutral");
+
+        // Join the chunks of structure. Returns the plaintext of the first
+        // candidate which passes CheckPlaintext, or a zero status. The
+        // candidates checked are added to *candidates, for the checkpoints.
+        static AESLib::Status Computation(Structure &structure, std::uint64_t *candidates = nullptr) {
+            using namespace AESLib;
+            using Metrics::Counter;
+
+            Metrics::Tally tally;
+            tally.Add(Counter::Structures);
+            Table forward_results;
+            {
+                Metrics::ScopedTimer timer(Metrics::Phase::Forward);
+                Word match[Config::FORWARD_COUNT];
+                structure.ForwardChunk(match);
+                forward_results.Reserve(Config::FORWARD_COUNT);
+                for (int i = 0; i < Config::FORWARD_COUNT; i++) {
+                    forward_results.Insert({(Neutral) i, match[i]});
+                }
+                forward_results.Build();
+                tally.Add(Counter::ForwardEvaluations, Config::FORWARD_COUNT);
+            }
+
+            Metrics::ScopedTimer timer(Metrics::Phase::Backward);
+            for (int i = 0; i < Config::BACKWARD_COUNT; i++) {
+                Word backward_match = structure.BackwardChunk((Neutral) i);
+                auto range = forward_results.Bucket(backward_match);
+                tally.Add(Counter::BackwardEvaluations);
+                tally.Add(Counter::Pairs, Config::FORWARD_COUNT);
+                tally.Probe(range.second - range.first);
+                for (auto iter = range.first; iter != range.second; iter++) {
+                    if (iter->match != backward_match) {
+                        continue;
+                    }
+                    Status plaintext = structure.ComputePlaintext(iter->neutral, (Neutral) i);
+                    tally.Add(Counter::Verifications);
+                    if (candidates != nullptr) {
+                        ++*candidates;
+                    }
+                    if (structure.CheckPlaintext(plaintext)) {
+                        return plaintext;
+                    }
+                    tally.Add(Counter::FalsePositives);
+                }
+            }
+            return {};
+        }
+
+        // Join the chunks of structure for every target, hits[t] being the
+        // plaintext found for targets[t] or a zero status. The backward chunk
+        // and the forward prefix don't depend on the target, so they are
+        // computed once, and the backward results are the table which the
+        // forward matches of every target probe. The structure is left at the
+        // last target. The candidates checked are added to *candidates.
+        static void Computation(
+                Structure &structure,
+                const std::vector<AESLib::Status> &targets,
+                std::vector<AESLib::Status> &hits,
+                std::uint64_t *candidates = nullptr
+        ) {
+            using namespace AESLib;
+            using Metrics::Counter;
+
+            Metrics::Tally tally;
+            tally.Add(Counter::Structures);
+            Table backward_results;
+            {
+                Metrics::ScopedTimer timer(Metrics::Phase::Backward);
+                backward_results.Reserve(Config::BACKWARD_COUNT);
+                for (int i = 0; i < Config::BACKWARD_COUNT; i++) {
+                    backward_results.Insert({(Neutral) i, structure.BackwardChunk((Neutral) i)});
+                }
+                backward_results.Build();
+                tally.Add(Counter::BackwardEvaluations, Config::BACKWARD_COUNT);
+            }
+
+            Metrics::ScopedTimer timer(Metrics::Phase::Forward);
+            Status prefix[Config::FORWARD_COUNT];
+            Word match[Config::FORWARD_COUNT];
+            structure.ForwardPrefix(prefix);
+            hits.assign(targets.size(), Status());
+            for (std::size_t t = 0; t < targets.size(); t++) {
+                structure.SetTarget(targets[t]);
+                structure.ForwardChunk(prefix, match);
+                tally.Add(Counter::ForwardEvaluations, Config::FORWARD_COUNT);
+                bool hit = false;
+                for (int i = 0; i < Config::FORWARD_COUNT && not hit; i++) {
+                    auto range = backward_results.Bucket(match[i]);
+                    tally.Add(Counter::Pairs, Config::BACKWARD_COUNT);
+                    tally.Probe(range.second - range.first);
+                    for (auto iter = range.first; iter != range.second; iter++) {
+                        if (iter->match != match[i]) {
+                            continue;
+                        }
+                        Status plaintext = structure.ComputePlaintext((Neutral) i, iter->neutral);
+                        tally.Add(Counter::Verifications);
+                        if (candidates != nullptr) {
+                            ++*candidates;
+                        }
+                        if (structure.CheckPlaintext(plaintext)) {
+                            hits[t] = plaintext;
+                            hit = true;
+                            break;
+                        }
+                        tally.Add(Counter::FalsePositives);
+                    }
+                }
+            }
+        }
+
+        // A structure from the random stream, timed as the setup phase.
+        static Structure Draw(const AESLib::AES &aes, const AESLib::Status &h_n, AESLib::RandomStream &stream) {
+            Metrics::ScopedTimer timer(Metrics::Phase::Setup);
+            return Structure(aes, h_n, stream);
+        }
+
+        // Search random structures for h_n on all hardware threads until one
+        // gives a solution. With a state path the progress is saved there
+        // every minute, and resume continues the search it holds. A shard
+        // searches every shard.count-th structure. With a metrics path the
+        // metrics of the search are written there every metrics interval.
+        static void Search(const AESLib::AES &aes, const AESLib::Status &h_n, const SearchOptions &options) {
+            using namespace AESLib;
+            using namespace std;
+
+            Checkpoint::State state;
+            if (not Checkpoint::Begin(Config::NAME, options.checkpoint, state)) {
+                return;
+            }
+            if (state.finished) {
+                Log::Normal("The search in " + options.checkpoint.state_path + " has already found a solution.");
+                return;
+            }
+            // The seed and a structure index are all it takes to replay a structure.
+            Log::Normal("Seed: " + to_string(state.seed));
+            Checkpoint::Checkpointer checkpointer(options.checkpoint.state_path, state, &Checkpoint::State::structure);
+
+            // Every job attacks one structure and then submits the next one, so
+            // the workers stay busy until a solution is found, whatever the
+            // structures cost. Two jobs per worker keep the deques from running
+            // dry.
+            CounterRandom random(state.seed);
+            ThreadPool pool;
+            Metrics::Reporter reporter(options.metrics_path, pool.Size(), options.metrics_interval);
+            atomic<bool> success_flag(false);
+            atomic<uint64_t> search_number(state.structure);
+            function<void()> job = [&]() {
+                if (success_flag.load()) {
+                    return;
+                }
+                uint64_t i = search_number++;
+                if (i % 10000 == 0) {
+                    Log::Normal(to_string(i) + " structures have been tested.");
+                }
+                RandomStream stream = random.Stream(state.GlobalIndex(i));
+                Structure structure = Draw(aes, h_n, stream);
+                uint64_t candidates = 0;
+                Status temp = Computation(structure, &candidates);
+                checkpointer.Done(i, candidates);
+                if (not(temp == Status()) && not success_flag.exchange(true)) {
+                    checkpointer.Finish(temp.ToHex());
+                    stringstream ss;
+                    ss << "Found a solution! It spends " << state.GlobalIndex(i) << " search to find." << endl
+                       << "Plaintext:" << endl
+                       << temp.ToString()
+                       << "H_n:" << endl
+                       << aes.CompressionFunction(temp).ToString();
+                    Log::Correct(ss.str());
+                }
+                pool.Submit(job);
+            };
+            for (int i = 0; i < 2 * pool.Size(); i++) {
+                pool.Submit(job);
+            }
+            pool.Wait();
+        }
+
+        // Search random structures for all of targets at once, as Search does
+        // for one, until every target is hit. Each structure is joined with
+        // every target, and a target's first hit is logged and saved to the
+        // state at once. The state belongs to the list of targets, so a
+        // resumed search needs the same list.
+        static void SearchTargets(
+                const AESLib::AES &aes,
+                const std::vector<AESLib::Status> &targets,
+                const SearchOptions &options
+        ) {
+            using namespace AESLib;
+            using namespace std;
+
+            Checkpoint::State state;
+            if (targets.empty() || not Checkpoint::Begin(string(Config::NAME) + "-targets", options.checkpoint, state)) {
+                return;
+            }
+            uint64_t targets_key = TargetsKey(targets);
+            if (options.checkpoint.resume && state.targets != targets_key) {
+                Log::Error("The search in " + options.checkpoint.state_path + " has other targets");
+                return;
+            }
+            state.targets = targets_key;
+            if (state.finished) {
+                Log::Normal("The search in " + options.checkpoint.state_path + " has already hit every target.");
+                return;
+            }
+            Log::Normal("Seed: " + to_string(state.seed));
+            Log::Normal(to_string(state.hits.size()) + " of " + to_string(targets.size()) + " targets hit so far.");
+            Checkpoint::Checkpointer checkpointer(options.checkpoint.state_path, state, &Checkpoint::State::structure);
+
+            CounterRandom random(state.seed);
+            ThreadPool pool;
+            Metrics::Reporter reporter(options.metrics_path, pool.Size(), options.metrics_interval);
+            atomic<bool> success_flag(false);
+            atomic<size_t> remaining(targets.size() - state.hits.size());
+            atomic<uint64_t> search_number(state.structure);
+            function<void()> job = [&]() {
+                if (success_flag.load()) {
+                    return;
+                }
+                uint64_t i = search_number++;
+                if (i % 10000 == 0) {
+                    Log::Normal(to_string(i) + " structures have been tested.");
+                }
+                RandomStream stream = random.Stream(state.GlobalIndex(i));
+                Structure structure = Draw(aes, targets[0], stream);
+                vector<Status> hits;
+                uint64_t candidates = 0;
+                Computation(structure, targets, hits, &candidates);
+                for (size_t t = 0; t < targets.size(); t++) {
+                    if (hits[t] == Status() || not checkpointer.Hit(t, hits[t].ToHex())) {
+                        continue;
+                    }
+                    Log::Correct("Target " + to_string(t) + " is hit by structure " +
+                                 to_string(state.GlobalIndex(i)) + ", plaintext " + hits[t].ToHex());
+                    if (--remaining == 0 && not success_flag.exchange(true)) {
+                        checkpointer.Finish("");
+                        Log::Correct("Every target is hit.");
+                    }
+                }
+                checkpointer.Done(i, candidates);
+                pool.Submit(job);
+            };
+            for (int i = 0; i < 2 * pool.Size(); i++) {
+                pool.Submit(job);
+            }
+            pool.Wait();
+        }
+    };
+
+    void Test();
+}
+
+#endif //AESHASHMITM_MITM_ATTACK_H
@@ -0,0 +1,35 @@
+#ifndef AESHASHMITM_PARALLEL_H
+#define AESHASHMITM_PARALLEL_H
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace AESLib {
+    // All hardware threads, or 1 when the count is unknown.
+    inline int DefaultThreadCount() {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : (int) n;
+    }
+
+    // Call f(t) for every t in [0, thread_count) on its own thread and wait
+    // for all of them. Worker 0 runs on the calling thread.
+    template<typename F>
+    void ParallelFor(int thread_count, F f) {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < thread_count; t++) {
+            threads.emplace_back(f, t);
+        }
+        f(0);
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+
+    // The part [begin, end) of n items which worker t of thread_count handles.
+    inline std::size_t SliceBegin(std::size_t n, int t, int thread_count) {
+        return n * t / thread_count;
+    }
+} // AESLib
+
+#endif //AESHASHMITM_PARALLEL_H
@@ -0,0 +1,24 @@
+#ifndef AESHASHMITM_SIMD_STATUS_H
+#define AESHASHMITM_SIMD_STATUS_H
+
+// Conversion between Status and __m128i, shared by the x86 kernels.
+// Only include it from files which are built for x86.
+
+#include "aes.h"
+#include <immintrin.h>
+
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+
+namespace AESLib {
+    // Status is stored column by column like __m128i in AES-NI, so loading
+    // and storing are plain aligned moves.
+    SSSE3_TARGET static inline __m128i LoadStatus(const Status &status) {
+        return _mm_load_si128((const __m128i *) status.value.data);
+    }
+
+    SSSE3_TARGET static inline void StoreStatus(Status &status, __m128i x) {
+        _mm_store_si128((__m128i *) status.value.data, x);
+    }
+} // AESLib
+
+#endif //AESHASHMITM_SIMD_STATUS_H
@@ -1,16 +1,207 @@
 #include "aes.h"
+#include "aes_simd.h"
+#include "batch_aes.h"
 #include "calculator.h"
+#include "checkpoint.h"
+#include "counter_random.h"
+#include "external_table.h"
+#include "gf.h"
 #include "log.h"
+#include "match_table.h"
+#include "metrics.h"
+#include "mitm_attack.h"
 #include "mitm_4_round.h"
 #include "mitm_7_round.h"
 #include "mitm_7_plus.h"
+#include "thread_pool.h"
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
-int main() {
+// Print the state of a whole search from the state files of its shards.
+static int MergeStates(const std::vector<std::string> &paths) {
+    using namespace std;
+    vector<Checkpoint::State> states(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (not Checkpoint::Load(paths[i], states[i])) {
+            return 1;
+        }
+    }
+    Checkpoint::State merged;
+    if (not Checkpoint::Merge(states, merged)) {
+        return 1;
+    }
+    stringstream ss;
+    ss << "Search " << merged.search << " with seed " << merged.seed << endl
+       << "Structures done: " << merged.structure << endl
+       << "Backward chunks done: " << merged.backward << endl
+       << "Candidates checked: " << merged.candidates << endl
+       << "Seconds spent: " << merged.seconds << endl;
+    for (const auto &hit: merged.hits) {
+        ss << "Target " << hit.first << " hit: " << hit.second << endl;
+    }
+    if (merged.finished) {
+        ss << "Solution: " << merged.solution;
+        Log::Correct(ss.str());
+    } else if (merged.exhausted) {
+        ss << "Every shard is exhausted without a solution.";
+        Log::Normal(ss.str());
+    } else {
+        ss << "No solution yet.";
+        Log::Normal(ss.str());
+    }
+    return 0;
+}
+
+// Without arguments the tests of every module run, the backend and SIMD
+// equivalence checks among them. "--search mitm4|mitm7|mitm7plus" runs a
+// search instead, saving its progress to "--state FILE", and "--resume"
+// continues the search saved there. "--shard k/N" runs shard k of N of the
+// search, which all shards have to start with the same "--seed S".
+// "--targets FILE" searches mitm7 structures for every digest in FILE at
+// once. "--metrics FILE" writes the counters and phase timers of the search
+// to FILE every "--metrics-interval S" seconds, 10 by default, as Prometheus
+// text when FILE ends in .prom and as JSON otherwise. "--external PREFIX"
+// keeps the mitm7plus forward table in files starting with PREFIX, written in
+// sorted runs of "--run-size N" results. "--merge FILE..." prints the state
+// of a search from its shards' states.
+int main(int argc, char *argv[]) {
     using namespace std;
     using namespace Log;
     using namespace AESLib;
     using namespace Calculator;
-    MITM7Plus::Test();
+
+    string search;
+    string targets_path;
+    MITM::SearchOptions options;
+    vector<string> merge_paths;
+    bool merge = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (merge) {
+            merge_paths.push_back(arg);
+        } else if (arg == "--search" && i + 1 < argc) {
+            search = argv[++i];
+        } else if (arg == "--state" && i + 1 < argc) {
+            options.checkpoint.state_path = argv[++i];
+        } else if (arg == "--resume") {
+            options.checkpoint.resume = true;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            stringstream ss(argv[++i]);
+            ss >> options.checkpoint.seed;
+            if (ss.fail() || not ss.eof()) {
+                Error("A seed is a number, not " + string(argv[i]));
+                return 1;
+            }
+        } else if (arg == "--shard" && i + 1 < argc) {
+            if (not Checkpoint::ParseShard(argv[++i], options.checkpoint.shard)) {
+                return 1;
+            }
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            options.metrics_path = argv[++i];
+        } else if (arg == "--metrics-interval" && i + 1 < argc) {
+            stringstream ss(argv[++i]);
+            long long seconds = 0;
+            ss >> seconds;
+            if (ss.fail() || not ss.eof() || seconds <= 0) {
+                Error("A metrics interval is a positive number of seconds, not " + string(argv[i]));
+                return 1;
+            }
+            options.metrics_interval = chrono::seconds(seconds);
+        } else if (arg == "--external" && i + 1 < argc) {
+            options.external_prefix = argv[++i];
+        } else if (arg == "--run-size" && i + 1 < argc) {
+            stringstream ss(argv[++i]);
+            ss >> options.external_run_size;
+            if (ss.fail() || not ss.eof() || options.external_run_size == 0) {
+                Error("A run size is a positive number of results, not " + string(argv[i]));
+                return 1;
+            }
+        } else if (arg == "--targets" && i + 1 < argc) {
+            targets_path = argv[++i];
+        } else if (arg == "--merge") {
+            merge = true;
+        } else {
+            Error("Unknown argument: " + arg);
+            cerr << "Usage: " << argv[0] << " [--search mitm4|mitm7|mitm7plus] [--state FILE] [--resume]"
+                 << " [--seed S] [--shard k/N] [--targets FILE] [--metrics FILE] [--metrics-interval S]"
+                 << " [--external PREFIX] [--run-size N]" << endl
+                 << "       " << argv[0] << " --merge FILE..." << endl;
+            return 1;
+        }
+    }
+    if (merge) {
+        return MergeStates(merge_paths);
+    }
+    if (argc == 1) {
+        GFTest();
+        AESTest();
+        BatchTest();
+        SIMDTest();
+        MatchTableTest();
+        ExternalTableTest();
+        ThreadPoolTest();
+        CounterRandomTest();
+        Checkpoint::Test();
+        Metrics::Test();
+        MITM::Test();
+        MITM4Round::Test();
+        MITM7Round::Test();
+        MITM7Round::ThreadTest();
+        MITM7Plus::Test();
+        return 0;
+    }
+    if (search.empty()) {
+        Error("The options need a --search");
+        return 1;
+    }
+    if (not options.external_prefix.empty() && search != "mitm7plus") {
+        Error("Only --search mitm7plus takes --external");
+        return 1;
+    }
+    if (not targets_path.empty() && search != "mitm7") {
+        Error("Only --search mitm7 takes --targets");
+        return 1;
+    }
+    if (options.checkpoint.shard.count > 1 && options.checkpoint.seed == 0 && not options.checkpoint.resume) {
+        Error("The shards of a search need a common --seed");
+        return 1;
+    }
+    if (options.checkpoint.state_path.empty()) {
+        options.checkpoint.state_path = targets_path.empty() ? search : search + "-targets";
+        if (options.checkpoint.shard.count > 1) {
+            options.checkpoint.state_path += "." + to_string(options.checkpoint.shard.index) + "of" + to_string(options.checkpoint.shard.count);
+        }
+        options.checkpoint.state_path += ".state";
+    }
+
+    if (not targets_path.empty()) {
+        MITM7Round::RunTargets(targets_path, options);
+    } else if (search == "mitm4") {
+        MITM4Round::Run(options);
+    } else if (search == "mitm7") {
+        MITM7Round::Run(options);
+    } else if (search == "mitm7plus") {
+        Byte key[16] = {
+                0x2b, 0x7e, 0x15, 0x16,
+                0x28, 0xae, 0xd2, 0xa6,
+                0xab, 0xf7, 0x15, 0x88,
+                0x09, 0xcf, 0x4f, 0x3c,
+        };
+        AES aes(key, 4, 7);
+        Status plaintext = Status(std::initializer_list<Byte>(
+                {
+                        0x32, 0x88, 0x31, 0xe0,
+                        0x43, 0x5a, 0x31, 0x37,
+                        0xf6, 0x30, 0x98, 0x07,
+                        0xa8, 0x8d, 0xa2, 0x34,
+                }
+        ));
+        MITM7Plus::Attack(aes.CompressionFunction(plaintext), options);
+    } else {
+        Error("Unknown search: " + search);
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,133 @@
+#include "thread_pool.h"
+
+#include "log.h"
+
+namespace AESLib {
+    // The pool and index of the worker running on this thread, if any.
+    static thread_local ThreadPool *current_pool = nullptr;
+    static thread_local int current_worker = -1;
+
+    ThreadPool::ThreadPool(int thread_count) {
+        if (thread_count < 1) {
+            thread_count = 1;
+        }
+        for (int i = 0; i < thread_count; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (int i = 0; i < thread_count; i++) {
+            threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+
+    int ThreadPool::Size() const {
+        return (int) workers.size();
+    }
+
+    void ThreadPool::Submit(std::function<void()> job) {
+        int index;
+        if (current_pool == this) {
+            index = current_worker;
+        } else {
+            index = (int) (next_worker++ % workers.size());
+        }
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    void ThreadPool::Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+    }
+
+    bool ThreadPool::Pop(int index, std::function<void()> &job) {
+        Worker &worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.jobs.empty()) {
+            return false;
+        }
+        job = std::move(worker.jobs.back());
+        worker.jobs.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool ThreadPool::Steal(int index, std::function<void()> &job) {
+        int n = (int) workers.size();
+        for (int i = 1; i < n; i++) {
+            Worker &victim = *workers[(index + i) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (not victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::WorkerLoop(int index) {
+        current_pool = this;
+        current_worker = index;
+        for (;;) {
+            std::function<void()> job;
+            if (Pop(index, job) || Steal(index, job)) {
+                job();
+                if (--pending == 0) {
+                    // Taking the lock orders this with the check in Wait().
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+
+    void ThreadPoolTest() {
+        // Jobs which submit more jobs, and waiting on the pool twice.
+        ThreadPool pool(4);
+        std::atomic<long long> sum{0};
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 1000; i++) {
+                pool.Submit([&pool, &sum, i]() {
+                    for (int j = 0; j < 10; j++) {
+                        pool.Submit([&sum, i, j]() {
+                            sum += i * 10 + j;
+                        });
+                    }
+                });
+            }
+            pool.Wait();
+        }
+        // Twice the sum of 0, ..., 9999.
+        if (sum == 2LL * 9999 * 10000 / 2) {
+            Log::Correct("Thread pool test: passed");
+        } else {
+            Log::Error("Thread pool test: failed");
+        }
+    }
+} // AESLib
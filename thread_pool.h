@@ -0,0 +1,62 @@
+#ifndef AESHASHMITM_THREAD_POOL_H
+#define AESHASHMITM_THREAD_POOL_H
+
+#include "parallel.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AESLib {
+    // A fixed set of long-lived workers with one job deque each. A worker runs
+    // the newest job of its own deque first and steals the oldest job of the
+    // others when its deque is empty. Jobs submitted from a worker go to its
+    // own deque, other jobs are spread round robin.
+    class ThreadPool {
+        struct Worker {
+            std::mutex mutex;
+            std::deque<std::function<void()>> jobs;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::atomic<int> queued{0};     // Jobs waiting in the deques.
+        std::atomic<int> pending{0};    // Jobs submitted and not finished yet.
+        std::atomic<unsigned int> next_worker{0};
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable wake;   // A job was queued or the pool stops.
+        std::condition_variable done;   // pending dropped to 0.
+
+        bool Pop(int index, std::function<void()> &job);
+
+        bool Steal(int index, std::function<void()> &job);
+
+        void WorkerLoop(int index);
+
+    public:
+        explicit ThreadPool(int thread_count = DefaultThreadCount());
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool();
+
+        [[nodiscard]] int Size() const;
+
+        void Submit(std::function<void()> job);
+
+        // Block until every submitted job, including the ones submitted by
+        // jobs, has finished.
+        void Wait();
+    };
+
+    void ThreadPoolTest();
+} // AESLib
+
+#endif //AESHASHMITM_THREAD_POOL_H